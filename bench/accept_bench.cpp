@@ -0,0 +1,91 @@
+// Connection-rate benchmark: one-shot accept() loop vs multishot accept stream.
+// usage: accept_bench [oneshot|multishot] [connections] [client threads]
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <liburing/io_service.hpp>
+
+static void connect_loop(uint16_t port, int count) {
+    sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr = {htonl(INADDR_LOOPBACK)},
+        .sin_zero = {0}
+    };
+    // reset instead of FIN so the client side never piles up TIME_WAIT sockets
+    linger lg = {.l_onoff = 1, .l_linger = 0};
+
+    for (int i = 0; i < count; ++i) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0) | coro::PanicOnErr("socket", true);
+        setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+        connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) | coro::PanicOnErr("connect", true);
+        ::close(fd);
+    }
+}
+
+static coro::Task<> accept_oneshot(coro::IOService& service, int serverfd, int count) {
+    for (int i = 0; i < count; ++i) {
+        int fd = co_await service.accept(serverfd, nullptr, nullptr) | coro::PanicOnErr("accept", false);
+        ::close(fd);
+    }
+}
+
+static coro::Task<> accept_multishot(coro::IOService& service, int serverfd, int count) {
+    auto acceptor = service.multishot_accept(serverfd);
+    for (int i = 0; i < count; ++i) {
+        int fd = (co_await acceptor.next()) | coro::PanicOnErr("multishot accept", false);
+        ::close(fd);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    std::string_view mode = argc > 1 ? argv[1] : "multishot";
+    int connections = argc > 2 ? std::atoi(argv[2]) : 100000;
+    int threads = argc > 3 ? std::atoi(argv[3]) : 4;
+    if ((mode != "oneshot" && mode != "multishot") || connections <= 0 || threads <= 0) {
+        fprintf(stderr, "Usage: %s [oneshot|multishot] [connections] [client threads]\n", argv[0]);
+        return 1;
+    }
+    connections -= connections % threads;
+
+    int sockfd = socket(AF_INET, SOCK_STREAM, 0) | coro::PanicOnErr("socket creation", true);
+    coro::OnScopeExit closesock([=]() { ::close(sockfd); });
+
+    sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = 0,
+        .sin_addr = {htonl(INADDR_LOOPBACK)},
+        .sin_zero = {0}
+    };
+    socklen_t addrlen = sizeof(addr);
+    if (bind(sockfd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr))) coro::Panic("bind", errno);
+    if (listen(sockfd, 4096)) coro::Panic("listen", errno);
+    getsockname(sockfd, reinterpret_cast<sockaddr*>(&addr), &addrlen);
+
+    coro::IOService service(1024);
+    auto task = mode == "oneshot"
+        ? accept_oneshot(service, sockfd, connections)
+        : accept_multishot(service, sockfd, connections);
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> clients;
+    for (int i = 0; i < threads; ++i) {
+        clients.emplace_back(connect_loop, ntohs(addr.sin_port), connections / threads);
+    }
+    service.run(task);
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    for (auto& t : clients) t.join();
+    printf("%-9s connections=%d threads=%d time=%.3fs rate=%.0f conn/s\n",
+        mode.data(), connections, threads, elapsed, connections / elapsed);
+}
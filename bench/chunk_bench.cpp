@@ -0,0 +1,101 @@
+// Reads a file in fixed-size chunks through for_each_concurrent() at increasing concurrency
+// limits, then all at once through when_all() over a vector. Reports throughput, the peak number
+// of reads in flight and io_uring_enter calls per read. The page cache is dropped before each
+// run unless `cached` is given.
+// usage: chunk_bench [chunks] [chunk KiB] [file] [cached]
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <numeric>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <liburing/io_service.hpp>
+#include <liburing/when_all_any.hpp>
+
+struct Reader {
+    coro::IOService& service;
+    int fd;
+    size_t chunk_size;
+    std::vector<char> buffers;
+    size_t in_flight = 0;
+    size_t peak = 0;
+    size_t bytes = 0;
+
+    // the buffer is picked by chunk index, concurrent reads never share one
+    coro::Task<> read(size_t index, size_t slot) {
+        peak = std::max(peak, ++in_flight);
+        int r = co_await service.read(fd, buffers.data() + slot * chunk_size, unsigned(chunk_size), off_t(index * chunk_size));
+        --in_flight;
+        if (r < 0) coro::Panic("read", -r);
+        bytes += size_t(r);
+    }
+};
+
+static coro::Task<> bounded(Reader& reader, const std::vector<size_t>& chunks, size_t limit) {
+    co_await coro::for_each_concurrent(chunks, limit, [&](size_t index) {
+        return reader.read(index, index);
+    });
+}
+
+static coro::Task<> unbounded(Reader& reader, const std::vector<size_t>& chunks) {
+    std::vector<coro::Task<>> reads;
+    reads.reserve(chunks.size());
+    for (size_t index : chunks) {
+        reads.push_back(reader.read(index, index));
+    }
+    co_await coro::when_all(std::move(reads));
+}
+
+int main(int argc, char* argv[]) {
+    size_t chunks = argc > 1 ? size_t(std::atol(argv[1])) : 10000;
+    size_t chunk_size = (argc > 2 ? size_t(std::atol(argv[2])) : 4) * 1024;
+    std::string path = argc > 3 ? argv[3] : "chunk_bench.dat";
+    bool cached = argc > 4 && std::string_view(argv[4]) == "cached";
+    if (chunks == 0 || chunk_size == 0) {
+        fprintf(stderr, "Usage: %s [chunks] [chunk KiB] [file] [cached]\n", argv[0]);
+        return 1;
+    }
+
+    int fd = open(path.c_str(), O_RDWR | O_CREAT, 0644) | coro::PanicOnErr("open", true);
+    {
+        std::vector<char> data(chunk_size, 'x');
+        for (size_t i = 0; i < chunks; ++i) {
+            int(pwrite(fd, data.data(), data.size(), off_t(i * chunk_size))) | coro::PanicOnErr("pwrite", true);
+        }
+        fsync(fd);
+    }
+
+    std::vector<size_t> order(chunks);
+    std::iota(order.begin(), order.end(), size_t(0));
+
+    printf("%-8s %12s %10s %10s %14s\n", "limit", "MiB/s", "reads/s", "in flight", "syscalls/read");
+    auto run = [&](const char* name, size_t limit) {
+        if (!cached) posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        coro::IOService service(256);
+        Reader reader{service, fd, chunk_size, std::vector<char>(chunks * chunk_size)};
+
+        auto start = std::chrono::steady_clock::now();
+        if (limit) {
+            service.run(bounded(reader, order, limit));
+        } else {
+            service.run(unbounded(reader, order));
+        }
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        printf("%-8s %12.1f %10.0f %10zu %14.4f\n", name, double(reader.bytes) / elapsed / (1 << 20),
+            double(chunks) / elapsed, reader.peak, service.stats().syscalls_per_op());
+    };
+
+    for (size_t limit : {1, 4, 16, 64, 256, 1024}) {
+        run(std::to_string(limit).c_str(), limit);
+    }
+    run("all", 0);
+
+    close(fd);
+    unlink(path.c_str());
+}
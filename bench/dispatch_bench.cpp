@@ -0,0 +1,144 @@
+// Cost of dispatching one cqe to its resolver.
+// `synthetic` feeds fabricated completions straight to IOService::dispatch(): `virtual` is the
+// vtable path every completion used to take, the other kinds are decoded from user_data tags.
+// `nop` runs real NOP batches through the ring for each completion mode, with heap allocations
+// per op: small callbacks live in pooled slots, large ones still allocate.
+// usage: dispatch_bench [completions] [batch]
+#include <array>
+#include <chrono>
+#include <coroutine>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+#include <liburing/io_service.hpp>
+
+using Clock = std::chrono::steady_clock;
+
+static uint64_t allocations = 0;
+
+void* operator new(size_t size) {
+    ++allocations;
+    if (void* p = std::malloc(size)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
+struct CountingResolver final : public coro::Resolver {
+    int sum = 0;
+
+    void resolve(int result, uint32_t) noexcept override {
+        sum += result;
+    }
+};
+
+static void report(const char* name, Clock::time_point start, uint64_t allocs_before, int n) {
+    double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+    printf("%-18s %10.2f ns/op %10.3f allocs/op\n", name, ns / n, double(allocations - allocs_before) / n);
+}
+
+static void synthetic(coro::IOService& service, int n) {
+    CountingResolver generic;
+    coro::ResumeResolver resume(std::noop_coroutine());
+    coro::DeferredResolver deferred;
+
+    struct {
+        const char* name;
+        uint64_t user_data;
+    } kinds[] = {
+        {"synthetic virtual", coro::tag_user_data(static_cast<coro::Resolver*>(&generic), coro::ResolverKind::generic)},
+        {"synthetic resume", coro::tag_user_data(&resume, coro::ResolverKind::resume)},
+        {"synthetic deferred", coro::tag_user_data(&deferred, coro::ResolverKind::deferred)},
+    };
+
+    for (auto [name, user_data] : kinds) {
+        uint64_t allocs = allocations;
+        auto start = Clock::now();
+        for (int i = 0; i < n; ++i) {
+            service.dispatch(user_data, i, 0);
+        }
+        report(name, start, allocs, n);
+    }
+}
+
+static coro::Task<> awaiter(coro::IOService& service, int ops) {
+    for (int i = 0; i < ops; ++i) {
+        co_await service.yield();
+    }
+}
+
+static coro::Task<> nop(coro::IOService& service, int n, int batch) {
+    {
+        uint64_t allocs = allocations;
+        auto start = Clock::now();
+        std::vector<coro::Task<>> tasks;
+        tasks.reserve(batch);
+        for (int i = 0; i < batch; ++i) {
+            tasks.push_back(awaiter(service, n / batch));
+        }
+        for (auto& t : tasks) {
+            co_await t;
+        }
+        report("nop resume", start, allocs, n);
+    }
+
+    {
+        std::vector<coro::DeferredResolver> resolvers(batch);
+        uint64_t allocs = allocations;
+        auto start = Clock::now();
+        for (int done = 0; done < n; done += batch) {
+            for (auto& r : resolvers) {
+                service.yield().set_deferred(r);
+            }
+            co_await service.yield();
+        }
+        report("nop deferred", start, allocs, n);
+    }
+
+    int sum = 0;
+    {
+        uint64_t allocs = allocations;
+        auto start = Clock::now();
+        for (int done = 0; done < n; done += batch) {
+            for (int i = 0; i < batch; ++i) {
+                service.yield().set_callback([&sum](int result) { sum += result; });
+            }
+            co_await service.yield();
+        }
+        report("nop callback", start, allocs, n);
+    }
+
+    {
+        std::array<int, 32> payload{};
+        uint64_t allocs = allocations;
+        auto start = Clock::now();
+        for (int done = 0; done < n; done += batch) {
+            for (int i = 0; i < batch; ++i) {
+                service.yield().set_callback([&sum, payload](int result) { sum += result + payload[0]; });
+            }
+            co_await service.yield();
+        }
+        report("nop large callback", start, allocs, n);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    int n = argc > 1 ? std::atoi(argv[1]) : 1000000;
+    int batch = argc > 2 ? std::atoi(argv[2]) : 256;
+    if (n <= 0 || batch <= 0 || n % batch) {
+        fprintf(stderr, "Usage: %s [completions] [batch], completions a multiple of batch\n", argv[0]);
+        return 1;
+    }
+
+    coro::IOService service(4096);
+    synthetic(service, n);
+    service.run(nop(service, n, batch));
+}
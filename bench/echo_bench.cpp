@@ -0,0 +1,169 @@
+// Echo throughput as the number of server cores grows.
+// For every step the server runs on cores [0, n) and the load generator on cores [n, 2n).
+// Heap allocations per message cover both sides; echo_bench_nopool is the same program built
+// with LIBURING_NO_FRAME_POOL, i.e. coroutine frames from operator new.
+// usage: echo_bench [max cores] [connections per core] [seconds per step] [message size]
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <liburing/io_service.hpp>
+#include <liburing/buffer_ring.hpp>
+#include <liburing/runtime.hpp>
+
+enum {
+    BUF_SIZE = 4096,
+    BUF_COUNT = 4096,
+    BUF_GROUP_ID = 1,
+};
+
+static std::atomic<uint64_t> allocations{0};
+
+void* operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
+static coro::Task<> echo(coro::IOService& service, coro::BufferRing& buffers, int clientfd) {
+    coro::RecvStream receiver(service, buffers, clientfd, MSG_NOSIGNAL);
+    while (true) {
+        auto chunk = co_await receiver.next();
+        if (!chunk) break;
+        co_await service.send(clientfd, chunk.data(), chunk.size(), MSG_NOSIGNAL);
+    }
+    co_await service.close(clientfd);
+}
+
+static coro::Task<> server(coro::IOService& service, int sockfd) {
+    coro::BufferRing buffers(service, BUF_GROUP_ID, BUF_COUNT, BUF_SIZE);
+    auto acceptor = service.multishot_accept(sockfd);
+    while (true) {
+        int clientfd = co_await acceptor.next();
+        if (clientfd >= 0) {
+            echo(service, buffers, clientfd);
+        } else if (clientfd == -EMFILE || clientfd == -ENFILE || clientfd == -ENOBUFS || clientfd == -ENOMEM) {
+            // out of fds or memory: wait for connections to close instead of spinning
+            co_await service.sleep_for(std::chrono::milliseconds(1));
+        } else if (clientfd != -EAGAIN && clientfd != -ECONNABORTED) {
+            coro::Panic("accept", -clientfd);
+        }
+    }
+}
+
+static coro::Task<uint64_t> client(coro::IOService& service, uint16_t port, size_t msg_size,
+    std::chrono::steady_clock::time_point deadline) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0) | coro::PanicOnErr("socket", true);
+    sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr = {htonl(INADDR_LOOPBACK)},
+        .sin_zero = {0}
+    };
+    co_await service.connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr))
+        | coro::PanicOnErr("connect", false);
+
+    std::string msg(msg_size, 'x');
+    std::string buf(msg_size, 0);
+    uint64_t round_trips = 0;
+    while (std::chrono::steady_clock::now() < deadline) {
+        co_await service.send(fd, msg.data(), msg.size(), MSG_NOSIGNAL) | coro::PanicOnErr("send", false);
+        for (size_t got = 0; got < msg_size;) {
+            int r = co_await service.recv(fd, buf.data() + got, unsigned(msg_size - got), 0);
+            if (r <= 0) co_return round_trips;
+            got += r;
+        }
+        ++round_trips;
+    }
+    co_await service.close(fd);
+    co_return round_trips;
+}
+
+static coro::Task<> load(coro::IOService& service, uint16_t port, int connections, size_t msg_size,
+    std::chrono::steady_clock::time_point deadline, std::atomic<uint64_t>& total) {
+    std::vector<coro::Task<uint64_t>> clients;
+    for (int i = 0; i < connections; ++i) {
+        clients.push_back(client(service, port, msg_size, deadline));
+    }
+    uint64_t sum = 0;
+    for (auto& c : clients) {
+        sum += co_await c;
+    }
+    total += sum;
+}
+
+int main(int argc, char* argv[]) {
+    unsigned ncpu = std::max(2u, std::thread::hardware_concurrency());
+    unsigned max_cores = argc > 1 ? unsigned(std::atoi(argv[1])) : ncpu / 2;
+    int connections = argc > 2 ? std::atoi(argv[2]) : 64;
+    double seconds = argc > 3 ? std::atof(argv[3]) : 3.0;
+    size_t msg_size = argc > 4 ? size_t(std::atoi(argv[4])) : 64;
+    if (max_cores == 0 || connections <= 0 || seconds <= 0 || msg_size == 0 || msg_size > BUF_SIZE) {
+        fprintf(stderr, "Usage: %s [max cores] [connections per core] [seconds per step] [message size]\n", argv[0]);
+        return 1;
+    }
+
+    printf("%6s %14s %12s %12s\n", "cores", "msgs/s", "per core", "allocs/msg");
+    for (unsigned n = 1; n <= max_cores; n *= 2) {
+        // bind every listener up front so no client races the server's start
+        std::vector<int> listeners{coro::reuseport_listener(0, 4096, INADDR_LOOPBACK)};
+        sockaddr_in addr{};
+        socklen_t addrlen = sizeof(addr);
+        getsockname(listeners[0], reinterpret_cast<sockaddr*>(&addr), &addrlen);
+        uint16_t port = ntohs(addr.sin_port);
+        while (listeners.size() < n) {
+            listeners.push_back(coro::reuseport_listener(port, 4096, INADDR_LOOPBACK));
+        }
+
+        std::vector<int> server_cpus, client_cpus;
+        for (unsigned i = 0; i < n; ++i) {
+            server_cpus.push_back(int(i % ncpu));
+            client_cpus.push_back(int((n + i) % ncpu));
+        }
+
+        coro::Runtime servers(server_cpus, 4096);
+        servers.start([&](coro::IOService& service, unsigned index) {
+            return server(service, listeners[index]);
+        });
+
+        std::atomic<uint64_t> total{0};
+        uint64_t allocs_before = allocations.load();
+        auto start = std::chrono::steady_clock::now();
+        auto deadline = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(seconds));
+        {
+            coro::Runtime clients(client_cpus, 4096);
+            clients.start([&](coro::IOService& service, unsigned) {
+                return load(service, port, connections, msg_size, deadline, total);
+            });
+            clients.join();
+        }
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        uint64_t allocs = allocations.load() - allocs_before;
+
+        servers.stop();
+        servers.join();
+        for (int fd : listeners) ::close(fd);
+
+        double rate = double(total.load()) / elapsed;
+        printf("%6u %14.0f %12.0f %12.3f\n", n, rate, rate / n, total ? double(allocs) / double(total.load()) : 0.0);
+    }
+}
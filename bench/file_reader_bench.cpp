@@ -0,0 +1,133 @@
+// Scanning a large file once, summing its words as a stand-in consumer: a blocking read() loop,
+// one co_await read() at a time, AsyncFileReader with its adaptive read-ahead, and mmap. The
+// file is dropped from the page cache before each run (POSIX_FADV_DONTNEED) so the scan hits the
+// disk, unless `warm` is given. Place the file on a real disk, tmpfs is always cached.
+// usage: file_reader_bench [file MiB] [file] [warm]
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <liburing/file_reader.hpp>
+#include <liburing/io_service.hpp>
+
+static constexpr size_t CHUNK = 128 * 1024;
+
+static uint64_t consume(std::span<const char> data) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i + sizeof(uint64_t) <= data.size(); i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, data.data() + i, sizeof(word));
+        sum += word;
+    }
+    return sum;
+}
+
+static uint64_t scan_read(int fd) {
+    std::vector<char> buffer(CHUNK);
+    uint64_t sum = 0;
+    for (off_t offset = 0;;) {
+        ssize_t r = pread(fd, buffer.data(), buffer.size(), offset);
+        if (r < 0) coro::Panic("pread", errno);
+        if (r == 0) break;
+        sum += consume({buffer.data(), size_t(r)});
+        offset += r;
+    }
+    return sum;
+}
+
+static coro::Task<uint64_t> scan_uring(coro::IOService& service, int fd) {
+    std::vector<char> buffer(CHUNK);
+    uint64_t sum = 0;
+    for (off_t offset = 0;;) {
+        int r = co_await service.read(fd, buffer.data(), buffer.size(), offset);
+        if (r < 0) coro::Panic("read", -r);
+        if (r == 0) break;
+        sum += consume({buffer.data(), size_t(r)});
+        offset += r;
+    }
+    co_return sum;
+}
+
+static coro::Task<uint64_t> scan_reader(coro::IOService& service, int fd, unsigned& depth) {
+    coro::AsyncFileReader reader(service, fd, 0, -1, CHUNK);
+    uint64_t sum = 0;
+    while (auto chunk = co_await reader.next()) {
+        sum += consume(chunk.data);
+    }
+    depth = reader.depth();
+    co_return sum;
+}
+
+static uint64_t scan_mmap(int fd, size_t size) {
+    void* p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) coro::Panic("mmap", errno);
+    madvise(p, size, MADV_SEQUENTIAL);
+    uint64_t sum = consume({static_cast<const char*>(p), size});
+    munmap(p, size);
+    return sum;
+}
+
+int main(int argc, char* argv[]) {
+    size_t size = (argc > 1 ? size_t(std::atol(argv[1])) : 4096) << 20;
+    std::string path = argc > 2 ? argv[2] : "file_reader_bench.dat";
+    bool warm = argc > 3 && std::string_view(argv[3]) == "warm";
+    if (size == 0) {
+        fprintf(stderr, "Usage: %s [file MiB] [file] [warm]\n", argv[0]);
+        return 1;
+    }
+
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644) | coro::PanicOnErr("open", true);
+    {
+        std::vector<char> data(1 << 20);
+        for (size_t i = 0; i < data.size(); ++i) {
+            data[i] = char(i * 131);
+        }
+        for (size_t done = 0; done < size; done += data.size()) {
+            int(write(fd, data.data(), data.size())) | coro::PanicOnErr("write", true);
+        }
+        fsync(fd);
+    }
+
+    printf("%-10s %10s %8s\n", "mode", "GB/s", "depth");
+    uint64_t expected = 0;
+    for (std::string_view mode : {"read", "uring", "reader", "mmap"}) {
+        if (!warm) {
+            posix_fadvise(fd, 0, off_t(size), POSIX_FADV_DONTNEED);
+        }
+
+        coro::IOService service(64);
+        unsigned depth = 1;
+        uint64_t sum;
+        auto start = std::chrono::steady_clock::now();
+        if (mode == "read") {
+            sum = scan_read(fd);
+        } else if (mode == "uring") {
+            sum = service.run(scan_uring(service, fd));
+        } else if (mode == "reader") {
+            sum = service.run(scan_reader(service, fd, depth));
+        } else {
+            sum = scan_mmap(fd, size);
+            depth = 0;
+        }
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        if (mode == "read") {
+            expected = sum;
+        } else if (sum != expected) {
+            coro::Panic("checksum", EIO);
+        }
+        printf("%-10s %10.2f %8u\n", mode.data(), double(size) / elapsed / 1e9, depth);
+    }
+
+    close(fd);
+    unlink(path.c_str());
+}
@@ -0,0 +1,106 @@
+// Plain reads into heap buffers against reads into leased FixedBufferPool buffers, which
+// IOService::read() submits as read_fixed, at 4 KiB and 128 KiB blocks with `depth` reads in
+// flight. With `direct` the file is opened O_DIRECT, where skipping the per-op page pinning
+// matters most (not supported on tmpfs).
+// usage: fixed_buffer_bench [file MiB] [depth] [file] [direct]
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <liburing/fixed_buffers.hpp>
+#include <liburing/io_service.hpp>
+
+struct Load {
+    int fd;
+    size_t block;
+    size_t blocks;
+    size_t next = 0;
+    size_t bytes = 0;
+};
+
+// each worker reads the next unread block into its own buffer until the file is done
+static coro::Task<> worker(coro::IOService& service, Load& load, char* buffer) {
+    while (load.next < load.blocks) {
+        off_t offset = off_t(load.next++ * load.block);
+        int r = co_await service.read(load.fd, buffer, load.block, offset);
+        if (r < 0) coro::Panic("read", -r);
+        load.bytes += size_t(r);
+    }
+}
+
+static coro::Task<> run(coro::IOService& service, Load& load, std::vector<char*> buffers) {
+    std::vector<coro::Task<>> workers;
+    for (char* buffer : buffers) {
+        workers.push_back(worker(service, load, buffer));
+    }
+    for (auto& w : workers) {
+        co_await w;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    size_t file_size = (argc > 1 ? size_t(std::atol(argv[1])) : 1024) << 20;
+    unsigned depth = argc > 2 ? unsigned(std::atoi(argv[2])) : 32;
+    std::string path = argc > 3 ? argv[3] : "fixed_buffer_bench.dat";
+    bool direct = argc > 4 && std::string_view(argv[4]) == "direct";
+    if (file_size == 0 || depth == 0) {
+        fprintf(stderr, "Usage: %s [file MiB] [depth] [file] [direct]\n", argv[0]);
+        return 1;
+    }
+
+    {
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644) | coro::PanicOnErr("open", true);
+        std::vector<char> data(1 << 20, 'x');
+        for (size_t done = 0; done < file_size; done += data.size()) {
+            int(write(fd, data.data(), data.size())) | coro::PanicOnErr("write", true);
+        }
+        fsync(fd);
+        close(fd);
+    }
+    int fd = open(path.c_str(), O_RDONLY | (direct ? O_DIRECT : 0)) | coro::PanicOnErr("open", true);
+
+    printf("%-7s %-6s %12s %12s %14s\n", "block", "mode", "MiB/s", "reads/s", "syscalls/read");
+    for (size_t block : {size_t(4) << 10, size_t(128) << 10}) {
+        for (bool fixed : {false, true}) {
+            coro::IOService service(256);
+            std::unique_ptr<coro::FixedBufferPool> pool;
+            std::vector<coro::BufferLease> leases;
+            std::vector<char> heap;
+            std::vector<char*> buffers;
+            if (fixed) {
+                pool = std::make_unique<coro::FixedBufferPool>(service, block, depth);
+                for (unsigned i = 0; i < depth; ++i) {
+                    leases.push_back(pool->lease());
+                    buffers.push_back(leases.back().data());
+                }
+            } else {
+                // page aligned like the pool's, for O_DIRECT
+                heap.resize(depth * block + 4096);
+                auto* base = reinterpret_cast<char*>((uintptr_t(heap.data()) + 4095) & ~uintptr_t(4095));
+                for (unsigned i = 0; i < depth; ++i) {
+                    buffers.push_back(base + i * block);
+                }
+            }
+
+            Load load{fd, block, file_size / block};
+            if (!direct) posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+            auto start = std::chrono::steady_clock::now();
+            service.run(run(service, load, buffers));
+            double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            printf("%-7s %-6s %12.1f %12.0f %14.4f\n", (std::to_string(block >> 10) + "K").c_str(),
+                fixed ? "fixed" : "plain", double(load.bytes) / elapsed / (1 << 20),
+                double(load.blocks) / elapsed, service.stats().syscalls_per_op());
+        }
+    }
+
+    close(fd);
+    unlink(path.c_str());
+}
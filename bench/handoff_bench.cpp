@@ -0,0 +1,57 @@
+// Cross-core ping-pong latency of schedule_on(): one coroutine hops between two rings pinned to
+// different cores, every round trip is two IORING_OP_MSG_RING handoffs.
+// usage: handoff_bench [round trips] [cpu a] [cpu b]
+#include <algorithm>
+#include <chrono>
+#include <coroutine>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include <liburing/io_service.hpp>
+#include <liburing/runtime.hpp>
+#include <liburing/schedule_on.hpp>
+
+static coro::Task<> ping(coro::Runtime& runtime, int round_trips) {
+    auto& home = runtime.service(0);
+    auto& away = runtime.service(1);
+    std::vector<double> samples;
+    samples.reserve(round_trips);
+
+    for (int i = 0; i < round_trips; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        co_await schedule_on(away) | coro::PanicOnErr("schedule_on away", false);
+        co_await schedule_on(home) | coro::PanicOnErr("schedule_on home", false);
+        samples.push_back(std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    std::sort(samples.begin(), samples.end());
+    auto at = [&](double q) { return samples[size_t(q * double(samples.size() - 1))]; };
+    double sum = 0;
+    for (double s : samples) sum += s;
+    printf("round trips=%d avg=%.0fns p50=%.0fns p99=%.0fns p999=%.0fns max=%.0fns\n",
+        round_trips, sum / samples.size(), at(0.5), at(0.99), at(0.999), samples.back());
+
+    runtime.stop();
+}
+
+static coro::Task<> idle() {
+    // keep the ring looping until the runtime stops
+    co_await std::suspend_always{};
+}
+
+int main(int argc, char* argv[]) {
+    int round_trips = argc > 1 ? std::atoi(argv[1]) : 100000;
+    int cpu_a = argc > 2 ? std::atoi(argv[2]) : 0;
+    int cpu_b = argc > 3 ? std::atoi(argv[3]) : 1;
+    if (round_trips <= 0) {
+        fprintf(stderr, "Usage: %s [round trips] [cpu a] [cpu b]\n", argv[0]);
+        return 1;
+    }
+
+    coro::Runtime runtime(std::vector<int>{cpu_a, cpu_b});
+    runtime.start([&](coro::IOService&, unsigned index) {
+        return index == 0 ? ping(runtime, round_trips) : idle();
+    });
+    runtime.join();
+}
@@ -0,0 +1,345 @@
+// Overheads of the runtime's building blocks: task frames, awaits, resolvers, NOP round trips
+// through the ring, callbacks against coroutines, when_all fan-out and PanicOnErr wrapping.
+// Each benchmark is warmed up, then run REPEATS times; the fastest run is reported as one JSON
+// line with a fixed key order and precision, so the output of two releases diffs line by line.
+// Cycles are the PERF_COUNT_HW_CPU_CYCLES of this thread ("cycles":"perf", or "perf_user" when
+// only user space may be counted), the TSC where perf events are unavailable ("tsc"), else 0.
+// usage: runtime_bench [ops]
+#include <algorithm>
+#include <chrono>
+#include <coroutine>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <new>
+#include <vector>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include <liburing/io_service.hpp>
+#include <liburing/utils.hpp>
+#include <liburing/when_all_any.hpp>
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr int REPEATS = 5;
+static constexpr unsigned BATCH = 64;
+
+static uint64_t allocations = 0;
+static volatile int sink = 0;
+
+void* operator new(size_t size) {
+    ++allocations;
+    if (void* p = std::malloc(size)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
+class CycleCounter {
+public:
+    CycleCounter() {
+        fd_ = open(false);
+        source_ = "perf";
+        if (fd_ < 0) {
+            fd_ = open(true);
+            source_ = "perf_user";
+        }
+        if (fd_ < 0) {
+#if defined(__x86_64__) || defined(__i386__)
+            source_ = "tsc";
+#else
+            source_ = "none";
+#endif
+        }
+    }
+
+    ~CycleCounter() {
+        if (fd_ >= 0) close(fd_);
+    }
+
+    CycleCounter(const CycleCounter&) = delete;
+    CycleCounter& operator=(const CycleCounter&) = delete;
+
+    uint64_t read() const noexcept {
+        if (fd_ >= 0) {
+            uint64_t count = 0;
+            return ::read(fd_, &count, sizeof(count)) == sizeof(count) ? count : 0;
+        }
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return 0;
+#endif
+    }
+
+    const char* source() const noexcept {
+        return source_;
+    }
+
+private:
+    static int open(bool user_only) {
+        perf_event_attr attr{};
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+        attr.exclude_kernel = user_only;
+        attr.exclude_hv = 1;
+        return int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+
+    int fd_;
+    const char* source_;
+};
+
+struct Result {
+    const char* name;
+    uint64_t ops;
+    double ns_per_op;
+    double cycles_per_op;
+    double allocs_per_op;
+};
+
+static CycleCounter cycles;
+static std::vector<Result> results;
+
+// `fn(n)` performs n ops
+template <typename Fn>
+static void measure(const char* name, uint64_t ops, Fn&& fn) {
+    fn(ops / 10 + 1);
+
+    constexpr double inf = std::numeric_limits<double>::infinity();
+    Result best{name, ops, inf, inf, inf};
+    for (int i = 0; i < REPEATS; ++i) {
+        uint64_t allocs = allocations;
+        uint64_t c0 = cycles.read();
+        auto start = Clock::now();
+        fn(ops);
+        double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+        uint64_t c = cycles.read() - c0;
+        best.ns_per_op = std::min(best.ns_per_op, ns / double(ops));
+        best.cycles_per_op = std::min(best.cycles_per_op, double(c) / double(ops));
+        best.allocs_per_op = std::min(best.allocs_per_op, double(allocations - allocs) / double(ops));
+    }
+    results.push_back(best);
+}
+
+static coro::Task<int> ready(int i) {
+    co_return i;
+}
+
+static coro::Task<> await_ready_loop(uint64_t n) {
+    for (uint64_t i = 0; i < n; ++i) {
+        sink = co_await ready(int(i));
+    }
+}
+
+// suspends, handing the coroutine to a ResumeResolver fed by hand
+struct Park {
+    coro::ResumeResolver& resolver;
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    void await_suspend(std::coroutine_handle<> handle) noexcept {
+        resolver = coro::ResumeResolver(handle);
+    }
+
+    void await_resume() const noexcept {}
+};
+
+static coro::Task<> parked(coro::ResumeResolver& resolver, uint64_t n) {
+    for (uint64_t i = 0; i < n; ++i) {
+        co_await Park{resolver};
+    }
+}
+
+static coro::Task<> yield_loop(coro::IOService& service, uint64_t n) {
+    for (uint64_t i = 0; i < n; ++i) {
+        co_await service.yield();
+    }
+}
+
+static coro::Task<> yield_loop_checked(coro::IOService& service, uint64_t n) {
+    for (uint64_t i = 0; i < n; ++i) {
+        co_await (service.yield() | coro::PanicOnErr("yield", false));
+    }
+}
+
+static coro::Task<> yield_batch(coro::IOService& service, uint64_t n) {
+    std::vector<coro::Task<>> tasks;
+    tasks.reserve(BATCH);
+    for (unsigned i = 0; i < BATCH; ++i) {
+        tasks.push_back(yield_loop(service, n / BATCH + (i < n % BATCH)));
+    }
+    for (auto& task : tasks) {
+        co_await task;
+    }
+}
+
+// BATCH chains of NOPs each issuing the next from its completion callback
+struct CallbackChains {
+    coro::IOService& service;
+    uint64_t left;
+    unsigned running = 0;
+    std::coroutine_handle<> waiter;
+
+    void issue() {
+        --left;
+        service.yield().set_callback([this](int) {
+            if (left) {
+                issue();
+            } else if (!--running) {
+                waiter.resume();
+            }
+        });
+    }
+
+    bool await_ready() const noexcept {
+        return !left;
+    }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+        waiter = handle;
+        for (; running < BATCH && left; ++running) {
+            issue();
+        }
+    }
+
+    void await_resume() const noexcept {}
+};
+
+static coro::Task<> callback_batch(coro::IOService& service, uint64_t n) {
+    co_await CallbackChains{service, n};
+}
+
+static coro::Task<> yielding(coro::IOService& service) {
+    co_await service.yield();
+}
+
+static coro::Task<> when_all_loop(coro::IOService* service, unsigned width, uint64_t n) {
+    for (uint64_t i = 0; i < n; ++i) {
+        if (service) {
+            std::vector<coro::Task<>> tasks;
+            tasks.reserve(width);
+            for (unsigned j = 0; j < width; ++j) {
+                tasks.push_back(yielding(*service));
+            }
+            co_await coro::when_all(std::move(tasks));
+        } else {
+            std::vector<coro::Task<int>> tasks;
+            tasks.reserve(width);
+            for (unsigned j = 0; j < width; ++j) {
+                tasks.push_back(ready(int(j)));
+            }
+            sink = (co_await coro::when_all(std::move(tasks))).back();
+        }
+    }
+}
+
+static void print_json() {
+#ifdef LIBURING_NO_FRAME_POOL
+    constexpr bool frame_pool = false;
+#else
+    constexpr bool frame_pool = true;
+#endif
+    printf("{\"suite\":\"runtime_bench\",\"version\":1,\"cycles\":\"%s\",\"frame_pool\":%s,\"repeats\":%d,\"benchmarks\":[\n",
+        cycles.source(), frame_pool ? "true" : "false", REPEATS);
+    for (size_t i = 0; i < results.size(); ++i) {
+        auto& r = results[i];
+        printf("{\"name\":\"%s\",\"ops\":%llu,\"ns_per_op\":%.2f,\"cycles_per_op\":%.1f,\"allocs_per_op\":%.3f}%s\n",
+            r.name, (unsigned long long)r.ops, r.ns_per_op, r.cycles_per_op, r.allocs_per_op,
+            i + 1 < results.size() ? "," : "");
+    }
+    printf("]}\n");
+}
+
+int main(int argc, char* argv[]) {
+    long long arg = argc > 1 ? std::atoll(argv[1]) : 1000000;
+    if (arg < int(BATCH)) {
+        fprintf(stderr, "Usage: %s [ops], at least %u\n", argv[0], BATCH);
+        return 1;
+    }
+    auto ops = uint64_t(arg);
+    coro::IOService service;
+
+    measure("task_create_destroy", ops, [](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            sink = ready(int(i)).get_result();
+        }
+    });
+
+    // includes creating the awaited task, see task_create_destroy
+    measure("co_await_ready_task", ops, [](uint64_t n) {
+        await_ready_loop(n).get_result();
+    });
+
+    measure("resume_resolver", ops, [&](uint64_t n) {
+        coro::ResumeResolver resolver;
+        auto task = parked(resolver, n);
+        uint64_t user_data = coro::tag_user_data(&resolver, coro::ResolverKind::resume);
+        for (uint64_t i = 0; i < n; ++i) {
+            service.dispatch(user_data, 0, 0);
+        }
+        task.get_result();
+    });
+
+    measure("nop_yield", ops, [&](uint64_t n) {
+        service.run(yield_loop(service, n));
+    });
+
+    // the same round trip through the Task PanicOnErr wraps an SqeAwaitable into
+    measure("nop_yield_panic_on_err", ops, [&](uint64_t n) {
+        service.run(yield_loop_checked(service, n));
+    });
+
+    measure("nop_coroutine_batch", ops, [&](uint64_t n) {
+        service.run(yield_batch(service, n));
+    });
+
+    measure("nop_callback_batch", ops, [&](uint64_t n) {
+        service.run(callback_batch(service, n));
+    });
+
+    // one op is one when_all over `width` tasks
+    struct {
+        const char* name;
+        unsigned width;
+    } fan_outs[] = {{"when_all_ready_2", 2}, {"when_all_ready_16", 16}, {"when_all_ready_128", 128}};
+    for (auto [name, width] : fan_outs) {
+        measure(name, std::max<uint64_t>(ops / width, 1), [&](uint64_t n) {
+            when_all_loop(nullptr, width, n).get_result();
+        });
+    }
+    measure("when_all_yield_16", std::max<uint64_t>(ops / 16, 1), [&](uint64_t n) {
+        service.run(when_all_loop(&service, 16, n));
+    });
+
+    measure("error_check_plain", ops, [](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            int r = sink;
+            if (r < 0) std::abort();
+            sink = (r + 1) & 0xffff;
+        }
+    });
+
+    measure("error_check_panic_on_err", ops, [](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            int r = sink | coro::PanicOnErr("bench", false);
+            sink = (r + 1) & 0xffff;
+        }
+    });
+
+    print_json();
+}
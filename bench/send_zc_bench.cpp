@@ -0,0 +1,95 @@
+// Loopback throughput of send() against send_zc(), plain and from a registered buffer, at a few
+// message sizes. A separate thread drains the connection with blocking recv()s; the sender's cpu
+// time is what zero copy saves. Loopback delivery still copies on the receiving side, so real
+// NICs gain more.
+// usage: send_zc_bench [MiB per run]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include <liburing/fixed_buffers.hpp>
+#include <liburing/io_service.hpp>
+
+enum class Mode { copy, zc, zc_fixed };
+
+static void drain(int listener) {
+    int fd = accept(listener, nullptr, nullptr) | coro::PanicOnErr("accept", true);
+    std::vector<char> buffer(1 << 20);
+    while (recv(fd, buffer.data(), buffer.size(), 0) > 0) {
+    }
+    ::close(fd);
+}
+
+static coro::Task<> sender(coro::IOService& service, int fd, Mode mode, const char* buf, size_t size, size_t total) {
+    for (size_t sent = 0; sent < total;) {
+        int r = mode == Mode::copy
+            ? co_await service.send(fd, buf, unsigned(size), MSG_WAITALL)
+            : co_await service.send_zc(fd, buf, size, MSG_WAITALL);
+        if (r < 0) coro::Panic("send", -r);
+        sent += size_t(r);
+    }
+}
+
+static double thread_cpu() {
+    rusage ru;
+    getrusage(RUSAGE_THREAD, &ru);
+    return double(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) + double(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+int main(int argc, char* argv[]) {
+    size_t total = (argc > 1 ? size_t(std::atol(argv[1])) : 4096) << 20;
+    if (total == 0) {
+        fprintf(stderr, "Usage: %s [MiB per run]\n", argv[0]);
+        return 1;
+    }
+
+    printf("%-6s %-9s %10s %14s\n", "KiB", "mode", "Gbit/s", "cpu s/GiB");
+    const char* names[] = {"send", "send_zc", "zc_fixed"};
+    for (size_t size : {size_t(4) << 10, size_t(64) << 10, size_t(1) << 20}) {
+        for (Mode mode : {Mode::copy, Mode::zc, Mode::zc_fixed}) {
+            int listener = socket(AF_INET, SOCK_STREAM, 0) | coro::PanicOnErr("socket", true);
+            sockaddr_in addr{};
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            socklen_t len = sizeof(addr);
+            bind(listener, reinterpret_cast<sockaddr*>(&addr), len) | coro::PanicOnErr("bind", true);
+            listen(listener, 1) | coro::PanicOnErr("listen", true);
+            getsockname(listener, reinterpret_cast<sockaddr*>(&addr), &len) | coro::PanicOnErr("getsockname", true);
+            std::thread receiver(drain, listener);
+
+            int fd = socket(AF_INET, SOCK_STREAM, 0) | coro::PanicOnErr("socket", true);
+            connect(fd, reinterpret_cast<sockaddr*>(&addr), len) | coro::PanicOnErr("connect", true);
+
+            coro::IOService service(64);
+            std::vector<char> heap(size, 'x');
+            const char* buf = heap.data();
+            std::unique_ptr<coro::FixedBufferPool> pool;
+            coro::BufferLease lease;
+            if (mode == Mode::zc_fixed) {
+                pool = std::make_unique<coro::FixedBufferPool>(service, size, 1);
+                lease = pool->lease();
+                buf = lease.data();
+            }
+
+            double cpu = thread_cpu();
+            auto start = std::chrono::steady_clock::now();
+            service.run(sender(service, fd, mode, buf, size, total));
+            double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            cpu = thread_cpu() - cpu;
+
+            ::close(fd);
+            receiver.join();
+            ::close(listener);
+
+            printf("%-6zu %-9s %10.2f %14.3f\n", size >> 10, names[int(mode)],
+                double(total) * 8 / elapsed / 1e9, cpu / (double(total) / (1 << 30)));
+        }
+    }
+}
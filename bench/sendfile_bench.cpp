@@ -0,0 +1,89 @@
+// Serving a file over a local socket pair: sendfile() splicing file -> pipe -> socket against
+// the read/send loop it falls back to, for a few blob sizes. A separate thread drains the socket
+// with blocking recv()s. The file sits in the page cache.
+// usage: sendfile_bench [MiB per run] [file]
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include <liburing/io_service.hpp>
+#include <liburing/sendfile.hpp>
+
+static void drain(int fd) {
+    std::vector<char> buffer(1 << 20);
+    while (recv(fd, buffer.data(), buffer.size(), 0) > 0) {
+    }
+}
+
+static coro::Task<> serve(coro::PipePool& pipes, int sock, int file, size_t blob, size_t total, bool splice) {
+    for (size_t sent = 0; sent < total; sent += blob) {
+        int64_t r = splice
+            ? co_await coro::sendfile(pipes, sock, file, 0, blob)
+            : co_await coro::detail::sendfile_copy(pipes.service(), sock, file, 0, blob);
+        if (r != int64_t(blob)) coro::Panic("sendfile", r < 0 ? int(-r) : EIO);
+    }
+}
+
+static double thread_cpu() {
+    rusage ru;
+    getrusage(RUSAGE_THREAD, &ru);
+    return double(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) + double(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+int main(int argc, char* argv[]) {
+    size_t total = (argc > 1 ? size_t(std::atol(argv[1])) : 4096) << 20;
+    std::string path = argc > 2 ? argv[2] : "sendfile_bench.dat";
+    size_t max_blob = size_t(64) << 20;
+    if (total == 0) {
+        fprintf(stderr, "Usage: %s [MiB per run] [file]\n", argv[0]);
+        return 1;
+    }
+
+    int file = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644) | coro::PanicOnErr("open", true);
+    {
+        std::vector<char> data(1 << 20, 'x');
+        for (size_t done = 0; done < max_blob; done += data.size()) {
+            int(write(file, data.data(), data.size())) | coro::PanicOnErr("write", true);
+        }
+    }
+
+    printf("%-8s %-9s %10s %14s\n", "blob KiB", "mode", "Gbit/s", "cpu s/GiB");
+    for (size_t blob : {size_t(64) << 10, size_t(1) << 20, max_blob}) {
+        for (bool splice : {false, true}) {
+            int fds[2];
+            socketpair(AF_UNIX, SOCK_STREAM, 0, fds) | coro::PanicOnErr("socketpair", true);
+            std::thread receiver(drain, fds[1]);
+
+            coro::IOService service(64);
+            coro::PipePool pipes(service);
+            size_t runs = std::max<size_t>(total / blob, 1);
+
+            double cpu = thread_cpu();
+            auto start = std::chrono::steady_clock::now();
+            service.run(serve(pipes, fds[0], file, blob, runs * blob, splice));
+            double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            cpu = thread_cpu() - cpu;
+
+            shutdown(fds[0], SHUT_WR);
+            receiver.join();
+            close(fds[0]);
+            close(fds[1]);
+
+            double bytes = double(runs * blob);
+            printf("%-8zu %-9s %10.2f %14.3f\n", blob >> 10, splice ? "sendfile" : "read/send",
+                bytes * 8 / elapsed / 1e9, cpu / (bytes / (1 << 30)));
+        }
+    }
+
+    close(file);
+    unlink(path.c_str());
+}
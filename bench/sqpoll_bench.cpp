@@ -0,0 +1,82 @@
+// SQPOLL against the default submission mode: every ring runs the same NOP load and reports
+// syscalls per op and per-op latency. In sqpoll mode all rings share one kernel poller thread.
+// usage: sqpoll_bench [default|sqpoll] [rings] [coroutines per ring] [ops per coroutine] [idle ms] [poller cpu]
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string_view>
+#include <vector>
+
+#include <liburing/io_service.hpp>
+#include <liburing/runtime.hpp>
+
+using Clock = std::chrono::steady_clock;
+
+struct RingResult {
+    std::vector<double> latencies;
+    coro::IOServiceStats stats;
+    double elapsed = 0;
+};
+
+static coro::Task<> worker(coro::IOService& service, int ops, std::vector<double>& latencies) {
+    for (int i = 0; i < ops; ++i) {
+        auto start = Clock::now();
+        co_await service.yield();
+        latencies.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+    }
+}
+
+static coro::Task<> load(coro::IOService& service, int coroutines, int ops, RingResult& result) {
+    result.latencies.reserve(size_t(coroutines) * ops);
+    auto start = Clock::now();
+    std::vector<coro::Task<>> workers;
+    for (int i = 0; i < coroutines; ++i) {
+        workers.push_back(worker(service, ops, result.latencies));
+    }
+    for (auto& w : workers) {
+        co_await w;
+    }
+    result.elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    result.stats = service.stats();
+}
+
+int main(int argc, char* argv[]) {
+    std::string_view mode = argc > 1 ? argv[1] : "sqpoll";
+    unsigned rings = argc > 2 ? unsigned(std::atoi(argv[2])) : 2;
+    int coroutines = argc > 3 ? std::atoi(argv[3]) : 64;
+    int ops = argc > 4 ? std::atoi(argv[4]) : 10000;
+    unsigned idle_ms = argc > 5 ? unsigned(std::atoi(argv[5])) : 1000;
+    int poller_cpu = argc > 6 ? std::atoi(argv[6]) : -1;
+    if ((mode != "default" && mode != "sqpoll") || rings == 0 || coroutines <= 0 || ops <= 0) {
+        fprintf(stderr, "Usage: %s [default|sqpoll] [rings] [coroutines per ring] [ops per coroutine] [idle ms] [poller cpu]\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<RingResult> results(rings);
+    coro::Runtime runtime(rings, 1024);
+    if (mode == "sqpoll") {
+        runtime.use_sqpoll(idle_ms, poller_cpu);
+    }
+    runtime.start([&](coro::IOService& service, unsigned index) {
+        return load(service, coroutines, ops, results[index]);
+    });
+    runtime.join();
+
+    std::vector<double> latencies;
+    coro::IOServiceStats total;
+    double elapsed = 0;
+    for (auto& r : results) {
+        latencies.insert(latencies.end(), r.latencies.begin(), r.latencies.end());
+        total.sqes += r.stats.sqes;
+        total.submit_calls += r.stats.submit_calls;
+        total.wakeups += r.stats.wakeups;
+        elapsed = std::max(elapsed, r.elapsed);
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    auto at = [&](double q) { return latencies[size_t(q * double(latencies.size() - 1))]; };
+    printf("%-7s rings=%u ops=%zu rate=%.0f ops/s syscalls/op=%.4f wakeups=%lu p50=%.1fus p99=%.1fus p999=%.1fus\n",
+        mode.data(), rings, latencies.size(), double(latencies.size()) / elapsed, total.syscalls_per_op(),
+        (unsigned long)total.wakeups, at(0.5), at(0.99), at(0.999));
+}
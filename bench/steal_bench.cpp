@@ -0,0 +1,96 @@
+// Skewed-load latency: every request lands on ring 0 and burns CPU after its I/O completes.
+// `static` runs the work inline on ring 0 (plain sharding), `stealing` hands it to the
+// WorkStealingPool so idle rings can take it.
+// usage: steal_bench [static|stealing] [workers] [batches] [requests per batch] [work us]
+#include <algorithm>
+#include <chrono>
+#include <coroutine>
+#include <cstdio>
+#include <cstdlib>
+#include <string_view>
+#include <vector>
+
+#include <liburing/io_service.hpp>
+#include <liburing/runtime.hpp>
+#include <liburing/work_stealing.hpp>
+
+using Clock = std::chrono::steady_clock;
+
+static void burn(std::chrono::microseconds work) {
+    auto until = Clock::now() + work;
+    while (Clock::now() < until) {}
+}
+
+static coro::Task<> request(coro::IOService& service, coro::WorkStealingPool* pool,
+    std::chrono::microseconds work, std::vector<double>& latencies) {
+    auto start = Clock::now();
+    // stands in for the I/O that precedes the CPU work
+    co_await service.yield();
+    if (pool) {
+        co_await pool->offload([=]() { burn(work); });
+    } else {
+        burn(work);
+    }
+    latencies.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+}
+
+static coro::Task<> generate(coro::Runtime& runtime, coro::IOService& service, coro::WorkStealingPool* pool,
+    int batches, int batch_size, std::chrono::microseconds work) {
+    std::vector<double> latencies;
+    latencies.reserve(size_t(batches) * batch_size);
+
+    auto start = Clock::now();
+    for (int b = 0; b < batches; ++b) {
+        std::vector<coro::Task<>> inflight;
+        for (int i = 0; i < batch_size; ++i) {
+            inflight.push_back(request(service, pool, work, latencies));
+        }
+        for (auto& t : inflight) {
+            co_await t;
+        }
+    }
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+    std::sort(latencies.begin(), latencies.end());
+    auto at = [&](double q) { return latencies[size_t(q * double(latencies.size() - 1))]; };
+    printf("%-8s requests=%zu rate=%.0f req/s p50=%.0fus p99=%.0fus p999=%.0fus max=%.0fus\n",
+        pool ? "stealing" : "static", latencies.size(), double(latencies.size()) / elapsed,
+        at(0.5), at(0.99), at(0.999), latencies.back());
+
+    runtime.stop();
+}
+
+static coro::Task<> idle() {
+    co_await std::suspend_always{};
+}
+
+int main(int argc, char* argv[]) {
+    std::string_view mode = argc > 1 ? argv[1] : "stealing";
+    unsigned workers = argc > 2 ? unsigned(std::atoi(argv[2])) : 4;
+    int batches = argc > 3 ? std::atoi(argv[3]) : 200;
+    int batch_size = argc > 4 ? std::atoi(argv[4]) : 64;
+    auto work = std::chrono::microseconds(argc > 5 ? std::atoi(argv[5]) : 50);
+    if ((mode != "static" && mode != "stealing") || workers == 0 || batches <= 0 || batch_size <= 0) {
+        fprintf(stderr, "Usage: %s [static|stealing] [workers] [batches] [requests per batch] [work us]\n", argv[0]);
+        return 1;
+    }
+
+    coro::Runtime runtime(workers, 1024);
+    coro::WorkStealingPool pool(workers);
+    runtime.start([&](coro::IOService& service, unsigned index) {
+        if (mode == "stealing") {
+            pool.attach(service, index);
+        }
+        return index == 0
+            ? generate(runtime, service, mode == "stealing" ? &pool : nullptr, batches, batch_size, work)
+            : idle();
+    });
+    runtime.join();
+
+    if (mode == "stealing") {
+        for (unsigned i = 0; i < workers; ++i) {
+            printf("worker %u: executed=%lu stolen=%lu\n", i,
+                (unsigned long)pool.executed(i), (unsigned long)pool.stolen(i));
+        }
+    }
+}
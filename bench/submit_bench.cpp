@@ -0,0 +1,60 @@
+// Submission policy trade-off: the same NOP-heavy load under every SubmitPolicy, reporting
+// throughput and io_uring_enter calls per operation.
+// usage: submit_bench [coroutines] [ops per coroutine] [batch] [budget us]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include <liburing/io_service.hpp>
+
+static coro::Task<> worker(coro::IOService& service, int ops) {
+    for (int i = 0; i < ops; ++i) {
+        co_await service.yield();
+    }
+}
+
+static coro::Task<> load(coro::IOService& service, int coroutines, int ops) {
+    std::vector<coro::Task<>> workers;
+    for (int i = 0; i < coroutines; ++i) {
+        workers.push_back(worker(service, ops));
+    }
+    for (auto& w : workers) {
+        co_await w;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    int coroutines = argc > 1 ? std::atoi(argv[1]) : 256;
+    int ops = argc > 2 ? std::atoi(argv[2]) : 10000;
+    unsigned batch = argc > 3 ? unsigned(std::atoi(argv[3])) : 32;
+    auto budget = std::chrono::microseconds(argc > 4 ? std::atoi(argv[4]) : 20);
+    if (coroutines <= 0 || ops <= 0 || batch == 0) {
+        fprintf(stderr, "Usage: %s [coroutines] [ops per coroutine] [batch] [budget us]\n", argv[0]);
+        return 1;
+    }
+
+    struct {
+        const char* name;
+        coro::SubmitPolicy policy;
+    } policies[] = {
+        {"per_loop", coro::SubmitPolicy::per_loop},
+        {"per_op", coro::SubmitPolicy::per_op},
+        {"batch", coro::SubmitPolicy::batch},
+        {"budget", coro::SubmitPolicy::budget},
+    };
+
+    printf("%-9s %14s %14s %10s\n", "policy", "ops/s", "syscalls/op", "flushes");
+    for (auto [name, policy] : policies) {
+        coro::IOService service(1024);
+        service.set_submit_policy(policy, batch, budget);
+
+        auto start = std::chrono::steady_clock::now();
+        service.run(load(service, coroutines, ops));
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        auto& stats = service.stats();
+        printf("%-9s %14.0f %14.4f %10lu\n", name, double(coroutines) * ops / elapsed,
+            stats.syscalls_per_op(), (unsigned long)stats.flushes);
+    }
+}
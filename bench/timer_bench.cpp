@@ -0,0 +1,70 @@
+// One million concurrent sleeps: `wheel` parks them on the IOService timer wheel, `kernel` gives
+// each one its own IORING_OP_TIMEOUT like timeout() callers do. Reports cpu time, peak RSS and
+// how late timers fire. Kernel-side timer memory doesn't show in RSS.
+// usage: timer_bench [wheel|kernel] [timers] [max sleep ms]
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string_view>
+#include <vector>
+#include <sys/resource.h>
+
+#include <liburing/io_service.hpp>
+
+using Clock = std::chrono::steady_clock;
+
+static coro::Task<> sleeper(coro::IOService& service, bool wheel, std::chrono::milliseconds duration, double& late) {
+    auto deadline = Clock::now() + duration;
+    if (wheel) {
+        co_await service.sleep_until(deadline);
+    } else {
+        auto ts = coro::dur2ts(duration);
+        co_await service.timeout(&ts);
+    }
+    late = std::chrono::duration<double, std::milli>(Clock::now() - deadline).count();
+}
+
+static coro::Task<> load(coro::IOService& service, bool wheel, int timers, int max_ms, std::vector<double>& lateness) {
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<int> dist(max_ms / 2, max_ms);
+    std::vector<coro::Task<>> sleepers;
+    sleepers.reserve(timers);
+    for (int i = 0; i < timers; ++i) {
+        sleepers.push_back(sleeper(service, wheel, std::chrono::milliseconds(dist(rng)), lateness[i]));
+    }
+    for (auto& s : sleepers) {
+        co_await s;
+    }
+}
+
+static double cpu_seconds(const rusage& ru) {
+    return double(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) + double(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+int main(int argc, char* argv[]) {
+    std::string_view mode = argc > 1 ? argv[1] : "wheel";
+    int timers = argc > 2 ? std::atoi(argv[2]) : 1000000;
+    int max_ms = argc > 3 ? std::atoi(argv[3]) : 2000;
+    if ((mode != "wheel" && mode != "kernel") || timers <= 0 || max_ms < 2) {
+        fprintf(stderr, "Usage: %s [wheel|kernel] [timers] [max sleep ms]\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<double> lateness(timers);
+    coro::IOService service(4096);
+
+    rusage before, after;
+    getrusage(RUSAGE_SELF, &before);
+    auto start = Clock::now();
+    service.run(load(service, mode == "wheel", timers, max_ms, lateness));
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    getrusage(RUSAGE_SELF, &after);
+
+    std::sort(lateness.begin(), lateness.end());
+    auto at = [&](double q) { return lateness[size_t(q * double(lateness.size() - 1))]; };
+    printf("%-6s timers=%d wall=%.2fs cpu=%.2fs maxrss=%ldMiB syscalls=%lu late p50=%.2fms p99=%.2fms max=%.2fms\n",
+        mode.data(), timers, elapsed, cpu_seconds(after) - cpu_seconds(before), after.ru_maxrss / 1024,
+        (unsigned long)service.stats().submit_calls, at(0.5), at(0.99), lateness.back());
+}
@@ -0,0 +1,90 @@
+// Durable appends of small records from a growing number of concurrent appenders: each appender
+// doing its own write + fdatasync, against WalWriter gathering everyone waiting into one write
+// and one fdatasync per commit. Place the file on a real disk, tmpfs syncs are free.
+// usage: wal_bench [seconds per run] [record bytes] [file]
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <liburing/io_service.hpp>
+#include <liburing/wal.hpp>
+
+using Clock = std::chrono::steady_clock;
+
+struct Load {
+    Clock::time_point end;
+    std::vector<char> record;
+    off_t offset = 0;       // for the appenders syncing on their own
+    uint64_t appends = 0;
+    uint64_t syncs = 0;
+};
+
+static coro::Task<> sync_each(coro::IOService& service, int fd, Load& load) {
+    while (Clock::now() < load.end) {
+        off_t offset = load.offset;
+        load.offset += off_t(load.record.size());
+        int r = co_await service.write(fd, load.record.data(), unsigned(load.record.size()), offset);
+        if (r < 0) coro::Panic("write", -r);
+        r = co_await service.fsync(fd, IORING_FSYNC_DATASYNC);
+        if (r < 0) coro::Panic("fsync", -r);
+        ++load.appends;
+        ++load.syncs;
+    }
+}
+
+static coro::Task<> group(coro::WalWriter& wal, Load& load) {
+    while (Clock::now() < load.end) {
+        off_t r = co_await wal.append(load.record);
+        if (r < 0) coro::Panic("append", int(-r));
+        ++load.appends;
+    }
+}
+
+static coro::Task<> run(coro::IOService& service, int fd, Load& load, unsigned appenders, bool grouped) {
+    coro::WalWriter wal(service, fd, 0);
+    std::vector<coro::Task<>> tasks;
+    for (unsigned i = 0; i < appenders; ++i) {
+        tasks.push_back(grouped ? group(wal, load) : sync_each(service, fd, load));
+    }
+    for (auto& task : tasks) {
+        co_await task;
+    }
+    if (grouped) {
+        load.syncs = wal.commits();
+    }
+}
+
+int main(int argc, char* argv[]) {
+    double seconds = argc > 1 ? std::atof(argv[1]) : 2;
+    size_t record = argc > 2 ? size_t(std::atol(argv[2])) : 128;
+    std::string path = argc > 3 ? argv[3] : "wal_bench.dat";
+    if (seconds <= 0 || record == 0) {
+        fprintf(stderr, "Usage: %s [seconds per run] [record bytes] [file]\n", argv[0]);
+        return 1;
+    }
+
+    printf("%-9s %-6s %12s %12s %14s\n", "appenders", "mode", "appends/s", "syncs/s", "appends/sync");
+    for (unsigned appenders : {1u, 2u, 4u, 8u, 16u, 32u, 64u, 128u}) {
+        for (bool grouped : {false, true}) {
+            int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644) | coro::PanicOnErr("open", true);
+            coro::IOService service(256);
+            Load load;
+            load.record.assign(record, 'r');
+            auto start = Clock::now();
+            load.end = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+            service.run(run(service, fd, load, appenders, grouped));
+            double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+            close(fd);
+
+            printf("%-9u %-6s %12.0f %12.0f %14.1f\n", appenders, grouped ? "group" : "each",
+                double(load.appends) / elapsed, double(load.syncs) / elapsed,
+                load.syncs ? double(load.appends) / double(load.syncs) : 0.0);
+        }
+    }
+    unlink(path.c_str());
+}
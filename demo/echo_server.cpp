@@ -1,5 +1,6 @@
 #include "liburing/utils.hpp"
 #include <unistd.h>
+#include <chrono>
 #include <iostream>
 #include <format>
 #include <sys/socket.h>
@@ -8,61 +9,83 @@
 #include <vector>
 #include <poll.h>
 #include <numeric>
+#include <cstring>
 
 #include <liburing/io_service.hpp>
+#include <liburing/buffer_ring.hpp>
+#include <liburing/runtime.hpp>
 
 enum {
     BUF_SIZE = 512,
+    BUF_COUNT = 1024,
+    BUF_GROUP_ID = 1,
     MAX_CONN_SIZE = 512
 };
 
-int runningCoroutines = 0;
+thread_local int runningCoroutines = 0;
 
 coro::Task<> accept_connection(coro::IOService& service, int serverfd) {
-    while (int clientfd = co_await service.accept(serverfd, nullptr, nullptr)) {
-        [](coro::IOService& service, int clientfd) -> coro::Task<> {
+    // one buffer pool shared by every connection, sized for the traffic in flight
+    coro::BufferRing buffers(service, BUF_GROUP_ID, BUF_COUNT, BUF_SIZE);
+    auto acceptor = service.multishot_accept(serverfd);
+    while (true) {
+        int clientfd = co_await acceptor.next();
+        if (clientfd == -EAGAIN || clientfd == -ECONNABORTED) {
+            continue;
+        } else if (clientfd == -EMFILE || clientfd == -ENFILE || clientfd == -ENOBUFS || clientfd == -ENOMEM) {
+            // retrying right away would spin until connections close and free some up
+            std::cerr << std::format("accept: {}, backing off\n", strerror(-clientfd));
+            co_await service.sleep_for(std::chrono::milliseconds(10));
+            continue;
+        } else if (clientfd < 0) {
+            // the connections share `buffers`, don't leave them behind
+            coro::Panic("accept", -clientfd);
+        }
+        [](coro::IOService& service, coro::BufferRing& buffers, int clientfd) -> coro::Task<> {
             std::cout << std::format("sock {} accepted; number of running coroutines: {}\n", 
                 clientfd, ++runningCoroutines);
 
-            std::vector<char> buf(BUF_SIZE);
+            coro::RecvStream receiver(service, buffers, clientfd, MSG_NOSIGNAL);
             while (true) {
-                co_await service.poll(clientfd, POLLIN);
-                int r = co_await service.recv(clientfd, buf.data(), buf.size(), MSG_NOSIGNAL);
-                if (r <= 0) break;
-                co_await service.send(clientfd, buf.data(), r, MSG_NOSIGNAL);
+                auto chunk = co_await receiver.next();
+                if (!chunk) break;
+                co_await service.send(clientfd, chunk.data(), chunk.size(), MSG_NOSIGNAL);
             }
 
             service.shutdown(clientfd, SHUT_RDWR, IOSQE_IO_LINK);
             co_await service.close(clientfd);
             std::cout << std::format("sockfd {} is closed; number of running coroutines: {}\n",
                 clientfd, --runningCoroutines);
-        }(service, clientfd);
+        }(service, buffers, clientfd);
     }
 }
 
+// every worker owns a SO_REUSEPORT listener, the kernel spreads connections across them
+coro::Task<> serve(coro::IOService& service, uint16_t server_port) {
+    int sockfd = coro::reuseport_listener(server_port, MAX_CONN_SIZE * 2);
+    coro::OnScopeExit closesock([=](){shutdown(sockfd, SHUT_RDWR);});
+    co_await accept_connection(service, sockfd);
+}
+
 int main(int argc, char* argv[]) {
     uint16_t server_port = 0;
-    if (argc == 2) {
+    unsigned threads = 1;
+    if (argc == 2 || argc == 3) {
         server_port = (uint16_t)std::strtoul(argv[1], nullptr, 10);
     }
-    if (server_port == 0) {
-        std::cerr << "Usage: " << argv[0] << " <server_port>\n";
+    if (argc == 3) {
+        threads = (unsigned)std::strtoul(argv[2], nullptr, 10);
+    }
+    if (server_port == 0 || threads == 0) {
+        std::cerr << "Usage: " << argv[0] << " <server_port> [threads]\n";
         return 1;
     }
 
-    coro::IOService service(MAX_CONN_SIZE);
-    int sockfd = socket(AF_INET, SOCK_STREAM, 0) | coro::PanicOnErr("socket creation", true);
-    coro::OnScopeExit closesock([=](){shutdown(sockfd, SHUT_RDWR);});
-
-    if (sockaddr_in addr = {
-        .sin_family = AF_INET,
-        .sin_port = htons(server_port),
-        .sin_addr = {INADDR_ANY},
-        .sin_zero = {0}
-    }; bind(sockfd, reinterpret_cast<sockaddr*>(&addr), sizeof(sockaddr_in))) coro::Panic("bind", errno);
+    coro::Runtime runtime(threads, MAX_CONN_SIZE);
+    runtime.start([=](coro::IOService& service, unsigned) {
+        return serve(service, server_port);
+    });
+    std::cout << std::format("Listening: {} on {} thread(s)\n", server_port, threads);
 
-    if (listen(sockfd, MAX_CONN_SIZE * 2)) coro::Panic("listen", errno);
-    std::cout << std::format("Listening: {}\n", server_port);
-
-    service.run(accept_connection(service, sockfd));
-}
\ No newline at end of file
+    runtime.join();
+}
@@ -0,0 +1,393 @@
+#pragma once
+
+#include <cerrno>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <span>
+#include <utility>
+#include <vector>
+#include <algorithm>
+#include <liburing.h>
+
+#include "io_service.hpp"
+#include "utils.hpp"
+
+namespace coro {
+
+struct RecvState;
+class RecvStream;
+
+// The buffers of a BufferRing and their bookkeeping, reference counted: the BufferRing, every
+// RecvState and every slice holding a buffer pin it, so a group outlives a BufferRing destroyed
+// while recvs are still in flight or slices still in use. Only the ring's thread touches it.
+struct BufferGroup final : public Resolver {
+    // `entries` must be a power of 2
+    BufferGroup(IOService& service, uint16_t bgid, unsigned entries, unsigned buf_size)
+        : service_(&service)
+        , bgid_(bgid)
+        , entries_(entries)
+        , buf_size_(buf_size)
+        , memory_(new char[size_t(entries) * buf_size]) {
+        int ret = 0;
+        br_ = io_uring_setup_buf_ring(&service.get_handle(), entries, bgid, 0, &ret);
+        if (br_) {
+            for (unsigned bid = 0; bid < entries; ++bid) {
+                io_uring_buf_ring_add(br_, buffer(bid).data(), buf_size, bid, io_uring_buf_ring_mask(entries), bid);
+            }
+            io_uring_buf_ring_advance(br_, entries);
+        } else if (ret == -EINVAL || ret == -ENOSYS) {
+            // pre-5.19 kernel, provide the buffers through a classic sqe
+            auto* sqe = service.io_uring_get_sqe_safe();
+            io_uring_prep_provide_buffers(sqe, memory_.get(), buf_size, entries, bgid, 0);
+            io_uring_sqe_set_data(sqe, nullptr);
+        } else {
+            Panic("io_uring_setup_buf_ring", -ret);
+        }
+        in_kernel_ = entries;
+    }
+
+    BufferGroup(const BufferGroup&) = delete;
+    BufferGroup& operator=(const BufferGroup&) = delete;
+
+    void acquire() noexcept {
+        ++refs_;
+    }
+
+    // the last reference gone, no recv can pick from the group anymore: unregister it
+    void release() noexcept {
+        if (--refs_) {
+            return;
+        }
+        if (br_) {
+            io_uring_free_buf_ring(&service_->get_handle(), br_, entries_, bgid_);
+            delete this;
+        } else {
+            // buffers provided by sqes still queued may be in the kernel's hands until the removal
+            // is through, see resolve()
+            auto* sqe = service_->io_uring_get_sqe_safe();
+            io_uring_prep_remove_buffers(sqe, entries_, bgid_);
+            io_uring_sqe_set_data(sqe, static_cast<Resolver*>(this));
+        }
+    }
+
+    // IORING_OP_REMOVE_BUFFERS completed
+    void resolve(int, uint32_t) noexcept override {
+        delete this;
+    }
+
+    [[nodiscard]]
+    std::span<char> buffer(uint16_t bid) const noexcept {
+        return {memory_.get() + size_t(bid) * buf_size_, buf_size_};
+    }
+
+    void give_back(uint16_t bid) noexcept;
+
+    IOService* service_;
+    io_uring_buf_ring* br_ = nullptr;
+    uint16_t bgid_;
+    unsigned entries_;
+    unsigned buf_size_;
+    unsigned in_kernel_ = 0;
+    unsigned refs_ = 1;
+    std::unique_ptr<char[]> memory_;
+    // streams whose multishot died of -ENOBUFS, re-armed once a buffer comes back
+    std::vector<RecvState*> starved_;
+};
+
+// A group of equally sized buffers handed to the kernel, which picks one per completed recv
+// (IOSQE_BUFFER_SELECT). Memory is shared by every stream reading from the group, so it scales
+// with the traffic in flight instead of the number of connections.
+// Uses a mapped buffer ring where available and falls back to IORING_OP_PROVIDE_BUFFERS.
+// The group itself lives on until its last stream and slice are gone, see BufferGroup.
+class BufferRing {
+public:
+    // `entries` must be a power of 2
+    BufferRing(IOService& service, uint16_t bgid, unsigned entries, unsigned buf_size)
+        : group_(new BufferGroup(service, bgid, entries, buf_size)) {}
+
+    ~BufferRing() {
+        group_->release();
+    }
+
+    BufferRing(const BufferRing&) = delete;
+    BufferRing& operator=(const BufferRing&) = delete;
+
+    [[nodiscard]]
+    uint16_t group() const noexcept {
+        return group_->bgid_;
+    }
+
+    [[nodiscard]]
+    std::span<char> buffer(uint16_t bid) const noexcept {
+        return group_->buffer(bid);
+    }
+
+    // number of buffers the kernel can still pick from
+    [[nodiscard]]
+    unsigned available() const noexcept {
+        return group_->in_kernel_;
+    }
+
+    // return a buffer picked by the kernel back to the group
+    void give_back(uint16_t bid) noexcept {
+        group_->give_back(bid);
+    }
+
+private:
+    friend class RecvStream;
+
+    BufferGroup* group_;
+};
+
+// A buffer picked by the kernel for one recv, given back to its group on destruction
+class BufferSlice {
+public:
+    BufferSlice(BufferGroup* buffers, int result, int bid) noexcept
+        : buffers_(buffers), result_(result), bid_(bid) {
+        if (bid_ >= 0) buffers_->acquire();
+    }
+
+    BufferSlice(BufferSlice&& other) noexcept
+        : buffers_(other.buffers_), result_(other.result_), bid_(std::exchange(other.bid_, -1)) {}
+
+    BufferSlice& operator=(BufferSlice&& other) noexcept {
+        release();
+        buffers_ = other.buffers_;
+        result_ = other.result_;
+        bid_ = std::exchange(other.bid_, -1);
+        return *this;
+    }
+
+    ~BufferSlice() {
+        release();
+    }
+
+    // bytes received, 0 on EOF or a negative errno
+    [[nodiscard]]
+    int result() const noexcept {
+        return result_;
+    }
+
+    explicit operator bool() const noexcept {
+        return result_ > 0;
+    }
+
+    [[nodiscard]]
+    char* data() const noexcept {
+        return bid_ < 0 ? nullptr : buffers_->buffer(uint16_t(bid_)).data();
+    }
+
+    [[nodiscard]]
+    size_t size() const noexcept {
+        return result_ > 0 ? size_t(result_) : 0;
+    }
+
+    [[nodiscard]]
+    std::span<char> span() const noexcept {
+        return {data(), size()};
+    }
+
+    // give the buffer back to its group before the slice goes out of scope
+    void release() noexcept {
+        if (bid_ >= 0) {
+            buffers_->give_back(uint16_t(std::exchange(bid_, -1)));
+            buffers_->release();
+        }
+    }
+
+private:
+    BufferGroup* buffers_;
+    int result_;
+    int bid_;
+};
+
+// Shared state of one multishot recv, heap allocated for the same reason as AcceptState
+struct RecvState final : public Resolver {
+    RecvState(IOService& service, BufferGroup& buffers, int sockfd, int flags) noexcept
+        : service_(&service), buffers_(&buffers), sockfd_(sockfd), flags_(flags) {
+        buffers_->acquire();
+    }
+
+    ~RecvState() {
+        buffers_->release();
+    }
+
+    void resolve(int result, uint32_t flags) noexcept override {
+        int bid = flags & IORING_CQE_F_BUFFER ? int(flags >> IORING_CQE_BUFFER_SHIFT) : -1;
+        if (bid >= 0) --buffers_->in_kernel_;
+
+        if (detached_) {
+            if (bid >= 0) buffers_->give_back(uint16_t(bid));
+            if (!(flags & IORING_CQE_F_MORE)) delete this;
+            return;
+        }
+
+        if (!(flags & IORING_CQE_F_MORE)) {
+            armed_ = false;
+            if (result == -EINVAL && multishot_ && !received_) {
+                // pre-6.0 kernel, keep going with one-shot buffer-select recvs
+                multishot_ = false;
+                arm();
+                return;
+            }
+            if (result == -ENOBUFS) {
+                parked_ = true;
+                buffers_->starved_.push_back(this);
+                return;
+            }
+            if (result > 0) arm();
+        }
+
+        received_ |= result > 0;
+        ready_.push_back({result, bid});
+        if (waiter_) {
+            std::exchange(waiter_, {}).resume();
+        }
+    }
+
+    void arm() noexcept {
+        auto* sqe = service_->io_uring_get_sqe_safe();
+        if (multishot_) {
+            io_uring_prep_recv_multishot(sqe, sockfd_, nullptr, 0, flags_);
+        } else {
+            io_uring_prep_recv(sqe, sockfd_, nullptr, 0, flags_);
+        }
+        sqe->flags |= IOSQE_BUFFER_SELECT;
+        sqe->buf_group = buffers_->bgid_;
+        io_uring_sqe_set_data(sqe, this);
+        armed_ = true;
+    }
+
+    // see AcceptState::cancel()
+    void cancel() noexcept {
+        cancel_user_data(*service_, reinterpret_cast<uint64_t>(static_cast<Resolver*>(this)));
+    }
+
+    struct Completion {
+        int result;
+        int bid;
+    };
+
+    IOService* service_;
+    BufferGroup* buffers_;
+    int sockfd_;
+    int flags_;
+    bool armed_ = false;
+    bool parked_ = false;
+    bool multishot_ = true;
+    bool received_ = false;
+    bool detached_ = false;
+    std::deque<Completion> ready_;
+    std::coroutine_handle<> waiter_;
+};
+
+inline void BufferGroup::give_back(uint16_t bid) noexcept {
+    if (br_) {
+        io_uring_buf_ring_add(br_, buffer(bid).data(), buf_size_, bid, io_uring_buf_ring_mask(entries_), 0);
+        io_uring_buf_ring_advance(br_, 1);
+    } else {
+        auto* sqe = service_->io_uring_get_sqe_safe();
+        io_uring_prep_provide_buffers(sqe, buffer(bid).data(), buf_size_, 1, bgid_, bid);
+        io_uring_sqe_set_data(sqe, nullptr);
+    }
+    ++in_kernel_;
+
+    if (!starved_.empty()) [[unlikely]] {
+        for (auto* state : std::exchange(starved_, {})) {
+            state->parked_ = false;
+            state->arm();
+        }
+    }
+}
+
+// A stream of received chunks backed by one multishot recv sqe, one cqe per message.
+// Each chunk is a BufferSlice of `buffers` that must be released before the group runs dry.
+class RecvStream {
+public:
+    RecvStream(IOService& service, BufferRing& buffers, int sockfd, int flags = 0) noexcept
+        : state_(new RecvState(service, *buffers.group_, sockfd, flags)) {
+        state_->arm();
+    }
+
+    RecvStream(RecvStream&& other) noexcept : state_(std::exchange(other.state_, nullptr)) {}
+    RecvStream& operator=(RecvStream&&) = delete;
+    RecvStream(const RecvStream&) = delete;
+    RecvStream& operator=(const RecvStream&) = delete;
+
+    ~RecvStream() {
+        if (!state_) {
+            return;
+        }
+        for (auto [result, bid] : state_->ready_) {
+            if (bid >= 0) state_->buffers_->give_back(uint16_t(bid));
+        }
+        state_->ready_.clear();
+        if (state_->armed_) {
+            state_->detached_ = true;
+            state_->cancel();
+        } else {
+            if (state_->parked_) {
+                std::erase(state_->buffers_->starved_, state_);
+            }
+            delete state_;
+        }
+    }
+
+    // wait for the next chunk; its result() is 0 on EOF and a negative errno on failure
+    auto next() noexcept {
+        struct AwaitRecv {
+            RecvState* state;
+            bool cancelled = false;
+
+            bool await_ready() const noexcept {
+                return !state->ready_.empty();
+            }
+
+#ifdef LIBURING_TRACE
+            trace::Await trace() const noexcept {
+                return {"recv_multishot", "fd", state->sockfd_};
+            }
+#endif
+
+            void await_suspend(std::coroutine_handle<> handle) noexcept {
+                if (!state->armed_ && !state->parked_) state->arm();
+                state->waiter_ = handle;
+                if (cancelled) [[unlikely]] cancel();
+            }
+
+            // see TaskContext::cancel(); the multishot ends with -ECANCELED, the next call re-arms
+            void cancel() noexcept {
+                cancelled = true;
+                if (!state->waiter_) {
+                    return;
+                }
+                if (state->armed_) {
+                    state->cancel();
+                } else if (state->parked_) {
+                    // waiting for buffers, nothing in the kernel: wake up from the loop instead
+                    std::erase(state->buffers_->starved_, state);
+                    state->parked_ = false;
+                    state->ready_.push_back({-ECANCELED, -1});
+                    state->service_->yield().set_callback([state = state](int) {
+                        if (state->waiter_) std::exchange(state->waiter_, {}).resume();
+                    });
+                }
+            }
+
+            BufferSlice await_resume() const noexcept {
+                auto [result, bid] = state->ready_.front();
+                state->ready_.pop_front();
+                return BufferSlice(state->buffers_, result, bid);
+            }
+        };
+
+        return AwaitRecv{state_};
+    }
+
+private:
+    RecvState* state_;
+};
+
+}
@@ -0,0 +1,263 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <coroutine>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <span>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "io_service.hpp"
+#include "utils.hpp"
+
+namespace coro {
+
+// One chunk handed out by AsyncFileReader::next(). `data` points into the reader's buffers and
+// stays valid until the following next() call.
+struct FileChunk {
+    std::span<const char> data;
+    off_t offset = 0;
+    int result = 0;         // bytes read, 0 at the end of the range or a negative errno
+
+    explicit operator bool() const noexcept {
+        return result > 0;
+    }
+};
+
+// Shared state of one AsyncFileReader, on the heap because reads still in flight when the reader
+// is destroyed complete into it; it deletes itself once the last one does.
+struct FileReaderState {
+    using Clock = std::chrono::steady_clock;
+
+    struct Slot final : public Resolver {
+        FileReaderState* state = nullptr;
+        char* buffer = nullptr;
+        off_t offset = 0;
+        unsigned length = 0;    // bytes asked for
+        unsigned filled = 0;    // bytes read so far, short reads are reissued for the rest
+        int result = 0;
+        bool ready = false;
+        Clock::time_point issued;
+
+        void resolve(int res, uint32_t) noexcept override {
+            state->complete(*this, res);
+        }
+    };
+
+    FileReaderState(IOService& service, int fd, off_t offset, off_t end, size_t chunk_size, unsigned max_depth)
+        : service(&service)
+        , fd(fd)
+        , chunk_size(chunk_size)
+        , next_offset(offset)
+        , end(end)
+        , max_depth(max_depth)
+        , slots(max_depth + 1)      // + the slot of the chunk the consumer holds
+        , memory(static_cast<char*>(std::aligned_alloc(4096, round_up(slots.size() * chunk_size))), &std::free) {
+        if (!memory) {
+            Panic("aligned_alloc", ENOMEM);
+        }
+        for (size_t i = 0; i < slots.size(); ++i) {
+            slots[i].state = this;
+            slots[i].buffer = memory.get() + i * chunk_size;
+        }
+    }
+
+    static size_t round_up(size_t size) noexcept {
+        return (size + 4095) & ~size_t(4095);
+    }
+
+    Slot& slot(uint64_t i) noexcept {
+        return slots[i % slots.size()];
+    }
+
+    // keep `depth` reads ahead of the consumer
+    void fill() noexcept {
+        while (tail - head < depth && next_offset < end) {
+            auto& s = slot(tail++);
+            s.offset = next_offset;
+            s.ready = false;
+            s.issued = Clock::now();
+            s.length = unsigned(std::min<off_t>(off_t(chunk_size), end - next_offset));
+            s.filled = 0;
+            next_offset += s.length;
+            read(s);
+        }
+    }
+
+    // read the part of `s` still missing
+    void read(Slot& s) noexcept {
+        auto* sqe = service->io_uring_get_sqe_safe();
+        io_uring_prep_read(sqe, fd, s.buffer + s.filled, s.length - s.filled, uint64_t(s.offset) + s.filled);
+        io_uring_sqe_set_data(sqe, static_cast<Resolver*>(&s));
+        service->sqe_armed();
+        ++in_flight;
+    }
+
+    void complete(Slot& s, int res) noexcept {
+        --in_flight;
+        if (detached) {
+            if (!in_flight) delete this;
+            return;
+        }
+
+        if (res > 0) {
+            s.filled += unsigned(res);
+            if (s.filled < s.length) {
+                read(s);
+                return;
+            }
+        }
+        // a chunk cut short by the end of the file is handed out as it is, the ones after it are
+        // empty and end the range
+        s.result = res < 0 ? res : int(s.filled);
+        s.ready = true;
+        observe(latency_ns, double(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - s.issued).count()));
+        adapt();
+        if (res != -ECANCELED) {
+            // no reading ahead again behind cancel()
+            fill();
+        }
+        if (waiter && &s == &slot(head)) {
+            std::exchange(waiter, {}).resume();
+        }
+    }
+
+    // Little's law: enough reads in flight to cover one read's latency at the rate the consumer
+    // asks for chunks. A consumer waiting on the disk asks as fast as the reads come back, which
+    // keeps growing the depth up to max_depth.
+    void adapt() noexcept {
+        if (latency_ns <= 0 || interval_ns <= 0) {
+            return;
+        }
+        double wanted = std::ceil(latency_ns / interval_ns) + 1;
+        depth = unsigned(std::clamp(wanted, 1.0, double(max_depth)));
+    }
+
+    // cancel every read in flight
+    void cancel() noexcept {
+        for (uint64_t i = head; i < tail; ++i) {
+            auto& s = slot(i);
+            if (!s.ready) cancel_user_data(*service, reinterpret_cast<uint64_t>(static_cast<Resolver*>(&s)));
+        }
+    }
+
+    static void observe(double& ewma, double sample) noexcept {
+        ewma = ewma > 0 ? ewma + (sample - ewma) / 8 : sample;
+    }
+
+    IOService* service;
+    int fd;
+    size_t chunk_size;
+    off_t next_offset;
+    off_t end;
+    unsigned max_depth;
+    unsigned depth = 2;
+    std::vector<Slot> slots;
+    std::unique_ptr<char, decltype(&std::free)> memory;
+    uint64_t head = 0;          // next slot handed to the consumer
+    uint64_t tail = 0;          // next slot to read into
+    unsigned in_flight = 0;
+    bool detached = false;
+    std::coroutine_handle<> waiter;
+    double latency_ns = 0;      // average time a read takes
+    double interval_ns = 0;     // average time between two next() calls
+    Clock::time_point last_next{};
+};
+
+// Reads a file sequentially, keeping reads in flight ahead of the consumer so it rarely waits
+// for the disk. Buffers are recycled in a ring of max_depth + 1 chunks, chunks are handed out
+// without copying. The read-ahead depth follows the observed read latency and consumption rate,
+// between 1 and `max_depth`. Buffers are 4 KiB aligned, so the fd may be opened O_DIRECT if
+// `chunk_size` and `offset` are block aligned too.
+class AsyncFileReader {
+public:
+    // reads [offset, offset + length), up to the end of the file if length is negative
+    AsyncFileReader(IOService& service, int fd, off_t offset = 0, off_t length = -1,
+        size_t chunk_size = 128 * 1024, unsigned max_depth = 32) {
+        if (length < 0) {
+            struct stat st;
+            fstat(fd, &st) | PanicOnErr("fstat", true);
+            length = std::max<off_t>(st.st_size - offset, 0);
+        }
+        if (int err = posix_fadvise(fd, offset, length, POSIX_FADV_SEQUENTIAL)) {
+            Panic("posix_fadvise", err);
+        }
+        state_ = new FileReaderState(service, fd, offset, offset + length, chunk_size, std::max(max_depth, 1u));
+    }
+
+    AsyncFileReader(AsyncFileReader&& other) noexcept : state_(std::exchange(other.state_, nullptr)) {}
+    AsyncFileReader& operator=(AsyncFileReader&&) = delete;
+    AsyncFileReader(const AsyncFileReader&) = delete;
+    AsyncFileReader& operator=(const AsyncFileReader&) = delete;
+
+    ~AsyncFileReader() {
+        if (!state_) {
+            return;
+        }
+        if (state_->in_flight) {
+            state_->detached = true;
+            state_->cancel();
+        } else {
+            delete state_;
+        }
+    }
+
+    // wait for the next chunk, releasing the previous one. Yields an empty chunk past the end.
+    auto next() noexcept {
+        struct AwaitChunk {
+            FileReaderState* state;
+
+            bool await_ready() noexcept {
+                auto now = FileReaderState::Clock::now();
+                if (state->last_next != FileReaderState::Clock::time_point{}) {
+                    FileReaderState::observe(state->interval_ns,
+                        double(std::chrono::duration_cast<std::chrono::nanoseconds>(now - state->last_next).count()));
+                    state->adapt();
+                }
+                state->last_next = now;
+
+                // the chunk handed out last, slot(head - 1), is free for reading into again
+                state->fill();
+                return state->head == state->tail || state->slot(state->head).ready;
+            }
+
+            void await_suspend(std::coroutine_handle<> handle) noexcept {
+                state->waiter = handle;
+            }
+
+            // see TaskContext::cancel(); the reads ahead go too, their chunks yield -ECANCELED
+            void cancel() noexcept {
+                state->cancel();
+            }
+
+            FileChunk await_resume() noexcept {
+                if (state->head == state->tail) {
+                    return {};
+                }
+                auto& s = state->slot(state->head++);
+                size_t size = s.result > 0 ? size_t(s.result) : 0;
+                return {{s.buffer, size}, s.offset, s.result};
+            }
+        };
+
+        return AwaitChunk{state_};
+    }
+
+    // reads currently kept in flight ahead of the consumer
+    [[nodiscard]]
+    unsigned depth() const noexcept {
+        return state_->depth;
+    }
+
+private:
+    FileReaderState* state_;
+};
+
+}
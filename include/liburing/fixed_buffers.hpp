@@ -0,0 +1,184 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <utility>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+#include "io_service.hpp"
+#include "utils.hpp"
+
+namespace coro {
+
+class BufferLease;
+
+// Equally sized buffers carved out of a few large regions registered with the ring at startup,
+// so reads and writes on them skip pinning and mapping user pages for every op. Leased buffers
+// are plain memory: IOService::read()/write() notice the registered range on their own and
+// submit read_fixed/write_fixed with the right buf_index.
+// A ring has a single registered buffer table, the pool owns it for its lifetime.
+// The pool must outlive every lease and every op on a leased buffer: destroying it unregisters
+// and unmaps the regions, so it panics if any buffer is still leased.
+class FixedBufferPool {
+public:
+    // regions stay below the kernel's 1 GiB per registered buffer
+    static constexpr size_t MAX_REGION = size_t(1) << 30;
+
+    // With `hugepages` the regions come from MAP_HUGETLB when the system has some reserved,
+    // transparent huge pages otherwise.
+    FixedBufferPool(IOService& service, size_t buffer_size, unsigned count, bool hugepages = false)
+        : service_(&service), buffer_size_(buffer_size), count_(count) {
+        if (buffer_size == 0 || buffer_size > MAX_REGION || count == 0) {
+            Panic("FixedBufferPool", EINVAL);
+        }
+        per_region_ = std::min<size_t>(MAX_REGION / buffer_size, count);
+        for (size_t left = count; left;) {
+            size_t buffers = std::min(left, per_region_);
+            regions_.push_back({map(buffers * buffer_size, hugepages), buffers * buffer_size});
+            left -= buffers;
+        }
+        service.register_buffers(regions_.data(), unsigned(regions_.size()));
+
+        free_.reserve(count);
+        for (unsigned i = count; i-- > 0;) {
+            free_.push_back(i);
+        }
+    }
+
+    ~FixedBufferPool() {
+        if (free_.size() < count_) {
+            Panic("FixedBufferPool: destroyed with buffers leased", EBUSY);
+        }
+        service_->unregister_buffers();
+        for (auto& region : regions_) {
+            munmap(region.iov_base, region.iov_len);
+        }
+    }
+
+    FixedBufferPool(const FixedBufferPool&) = delete;
+    FixedBufferPool& operator=(const FixedBufferPool&) = delete;
+
+    // a free buffer, or an empty lease if all are out
+    [[nodiscard]]
+    inline BufferLease lease() noexcept;
+
+    [[nodiscard]]
+    size_t buffer_size() const noexcept {
+        return buffer_size_;
+    }
+
+    // buffers not leased
+    [[nodiscard]]
+    size_t available() const noexcept {
+        return free_.size();
+    }
+
+private:
+    friend class BufferLease;
+
+    static void* map(size_t size, bool hugepages) {
+        constexpr int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE;
+        if (hugepages) {
+            void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB, -1, 0);
+            if (p != MAP_FAILED) {
+                return p;
+            }
+        }
+        void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+        if (p == MAP_FAILED) {
+            Panic("mmap", errno);
+        }
+        if (hugepages) {
+            madvise(p, size, MADV_HUGEPAGE);
+        }
+        return p;
+    }
+
+    [[nodiscard]]
+    char* buffer(unsigned id) const noexcept {
+        return static_cast<char*>(regions_[id / per_region_].iov_base) + (id % per_region_) * buffer_size_;
+    }
+
+    IOService* service_;
+    size_t buffer_size_;
+    unsigned count_;
+    size_t per_region_ = 1;
+    std::vector<iovec> regions_;
+    std::vector<unsigned> free_;
+};
+
+// A buffer of a FixedBufferPool, handed back on destruction
+class BufferLease {
+public:
+    BufferLease() noexcept = default;
+
+    BufferLease(BufferLease&& other) noexcept
+        : pool_(std::exchange(other.pool_, nullptr)), id_(other.id_) {}
+
+    BufferLease& operator=(BufferLease&& other) noexcept {
+        release();
+        pool_ = std::exchange(other.pool_, nullptr);
+        id_ = other.id_;
+        return *this;
+    }
+
+    ~BufferLease() {
+        release();
+    }
+
+    explicit operator bool() const noexcept {
+        return pool_;
+    }
+
+    [[nodiscard]]
+    char* data() const noexcept {
+        return pool_ ? pool_->buffer(id_) : nullptr;
+    }
+
+    [[nodiscard]]
+    size_t size() const noexcept {
+        return pool_ ? pool_->buffer_size_ : 0;
+    }
+
+    [[nodiscard]]
+    std::span<char> span() const noexcept {
+        return {data(), size()};
+    }
+
+    // index of the registered region holding the buffer, for read_fixed()/write_fixed()
+    [[nodiscard]]
+    int buf_index() const noexcept {
+        return pool_ ? int(id_ / pool_->per_region_) : -1;
+    }
+
+    // hand the buffer back before the lease goes out of scope
+    void release() noexcept {
+        if (pool_) {
+            std::exchange(pool_, nullptr)->free_.push_back(id_);
+        }
+    }
+
+private:
+    friend class FixedBufferPool;
+
+    BufferLease(FixedBufferPool* pool, unsigned id) noexcept : pool_(pool), id_(id) {}
+
+    FixedBufferPool* pool_ = nullptr;
+    unsigned id_ = 0;
+};
+
+inline BufferLease FixedBufferPool::lease() noexcept {
+    if (free_.empty()) {
+        return {};
+    }
+    unsigned id = free_.back();
+    free_.pop_back();
+    return BufferLease(this, id);
+}
+
+}
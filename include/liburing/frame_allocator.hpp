@@ -0,0 +1,162 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace coro {
+
+// Counters of the calling thread's frame cache; all zero unless built with LIBURING_FRAME_STATS
+struct FrameAllocatorStats {
+    uint64_t allocations = 0;   // frames handed out
+    uint64_t oversized = 0;     // of which too large for a size class, served by operator new
+    uint64_t refills = 0;       // free lists refilled from the depot or a new slab
+    uint64_t slabs = 0;         // slabs carved out by this thread
+};
+
+// Size-class slab allocator for coroutine frames, used by Task promises unless built with
+// LIBURING_NO_FRAME_POOL.
+// Each thread keeps a free list per power-of-two size class, so allocating and freeing a frame
+// is a pointer pop/push. Frames may be freed on another thread than the one that allocated them
+// (schedule_on, work stealing): the block simply joins that thread's list. Lists grown too long,
+// and those of exiting threads, go back to a shared depot. Slabs are never returned to the system.
+class FrameAllocator {
+public:
+    static constexpr size_t MIN_CLASS = 64;
+    static constexpr size_t CLASSES = 7;    // 64 B .. 4 KiB
+    static constexpr size_t MAX_SIZE = MIN_CLASS << (CLASSES - 1);
+    static constexpr size_t SLAB_SIZE = 64 * 1024;
+
+    [[nodiscard]]
+    static void* allocate(size_t size) {
+        auto& cache = local();
+#ifdef LIBURING_FRAME_STATS
+        ++cache.stats.allocations;
+#endif
+        if (size > MAX_SIZE) [[unlikely]] {
+#ifdef LIBURING_FRAME_STATS
+            ++cache.stats.oversized;
+#endif
+            return ::operator new(size);
+        }
+
+        size_t c = size_class(size);
+        if (!cache.free[c]) [[unlikely]] {
+            cache.refill(c);
+        }
+        --cache.count[c];
+        return std::exchange(cache.free[c], cache.free[c]->next);
+    }
+
+    static void deallocate(void* p, size_t size) noexcept {
+        if (size > MAX_SIZE) [[unlikely]] {
+            ::operator delete(p, size);
+            return;
+        }
+
+        auto& cache = local();
+        size_t c = size_class(size);
+        cache.free[c] = new (p) Block{cache.free[c]};
+        if (++cache.count[c] > 2 * blocks_per_slab(c)) [[unlikely]] {
+            // frames keep being freed here but allocated elsewhere
+            cache.give_back(c);
+        }
+    }
+
+    // counters of the calling thread
+    [[nodiscard]]
+    static FrameAllocatorStats stats() noexcept {
+        return local().stats;
+    }
+
+private:
+    struct Block {
+        Block* next;
+    };
+
+    // a free list handed over to the depot
+    struct Chain {
+        Block* head;
+        uint32_t count;
+    };
+
+    struct Depot {
+        std::mutex mutex;
+        std::array<std::vector<Chain>, CLASSES> chains;
+    };
+
+    struct Cache {
+        std::array<Block*, CLASSES> free{};
+        std::array<uint32_t, CLASSES> count{};
+        FrameAllocatorStats stats{};
+
+        ~Cache() {
+            for (size_t c = 0; c < CLASSES; ++c) {
+                if (free[c]) give_back(c);
+            }
+        }
+
+        void refill(size_t c) {
+#ifdef LIBURING_FRAME_STATS
+            ++stats.refills;
+#endif
+            {
+                auto& d = depot();
+                std::lock_guard lock(d.mutex);
+                if (!d.chains[c].empty()) {
+                    auto chain = d.chains[c].back();
+                    d.chains[c].pop_back();
+                    free[c] = chain.head;
+                    count[c] = chain.count;
+                    return;
+                }
+            }
+
+#ifdef LIBURING_FRAME_STATS
+            ++stats.slabs;
+#endif
+            auto* slab = static_cast<std::byte*>(::operator new(SLAB_SIZE));
+            size_t block = MIN_CLASS << c;
+            for (size_t off = SLAB_SIZE; off >= block; off -= block) {
+                free[c] = new (slab + off - block) Block{free[c]};
+            }
+            count[c] = uint32_t(blocks_per_slab(c));
+        }
+
+        void give_back(size_t c) noexcept {
+            auto& d = depot();
+            std::lock_guard lock(d.mutex);
+            try {
+                d.chains[c].push_back({std::exchange(free[c], nullptr), std::exchange(count[c], 0)});
+            } catch (...) {
+                // out of memory for the bookkeeping: the blocks are lost, not corrupted
+            }
+        }
+    };
+
+    static constexpr size_t size_class(size_t size) noexcept {
+        return size_t(std::bit_width((size - 1) | (MIN_CLASS - 1)) - std::countr_zero(MIN_CLASS));
+    }
+
+    static constexpr size_t blocks_per_slab(size_t c) noexcept {
+        return SLAB_SIZE / (MIN_CLASS << c);
+    }
+
+    static Depot& depot() noexcept {
+        // leaked on purpose, so threads exiting after static destruction can still give back
+        static Depot* depot = new Depot;
+        return *depot;
+    }
+
+    static Cache& local() noexcept {
+        thread_local Cache cache;
+        return cache;
+    }
+};
+
+}
@@ -1,11 +1,24 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <deque>
 #include <functional>
 #include <initializer_list>
+#include <iterator>
+#include <utility>
+#include <vector>
 #include <liburing.h>
 
+#include "latency.hpp"
+#include "multishot.hpp"
 #include "sqe_awaitable.hpp"
 #include "task.hpp"
+#include "timer_wheel.hpp"
 #include "utils.hpp"
 
 #ifdef LIBURING_VERBOSE
@@ -18,13 +31,154 @@
 
 namespace coro {
 
+// Coroutines made ready outside of the ring, which run() resumes between completions.
+// See WorkStealingPool.
+struct RunQueue {
+    // resume some queued coroutines
+    virtual void run_some() noexcept = 0;
+    // run() is about to block in the kernel; returning false keeps it from waiting
+    virtual bool prepare_wait() noexcept = 0;
+};
+
+// When prepared sqes are handed to the kernel.
+// Fewer submissions mean fewer syscalls per op, earlier ones mean lower latency. No policy submits
+// early while an op handed out as an awaitable hasn't been awaited yet: its sqe has no user_data.
+enum class SubmitPolicy {
+    per_loop,   // once per run() iteration, right before waiting for completions (default)
+    per_op,     // as soon as an sqe is awaited
+    batch,      // once `batch` sqes are pending, or at the end of the iteration
+    budget,     // once the oldest pending sqe has waited `budget`, or at the end of the iteration
+};
+
+// Cumulative counters of one IOService. A ring spending most of its loop time in `run_time` is
+// CPU bound; many submit_calls per op or few cqes per loop point at syscall overhead.
+struct IOServiceStats {
+    uint64_t sqes = 0;          // sqes prepared
+    uint64_t submitted = 0;     // sqes the kernel took, summed over all submissions
+    uint64_t submit_calls = 0;  // io_uring_enter calls made to submit and/or wait
+    uint64_t flushes = 0;       // submissions made outside of the run() loop
+    uint64_t wakeups = 0;       // SQPOLL thread wake-ups, part of submit_calls
+    uint64_t backlogged = 0;    // sqes parked in the backlog because the SQ was full
+    uint64_t busy = 0;          // submissions the kernel refused with -EBUSY/-EAGAIN
+    uint64_t sq_full = 0;       // times io_uring_get_sqe_safe() found no free sqe
+    uint64_t loops = 0;         // run() iterations
+    uint64_t waits = 0;         // iterations that blocked in the kernel for a completion
+    uint64_t cqes = 0;          // completions handled by run()
+    uint64_t cq_overflows = 0;  // completions the kernel dropped on a full CQ (no IORING_FEAT_NODROP)
+    uint64_t cq_held = 0;       // iterations where the kernel held completions back for a full CQ
+    // iterations by completions handled: 0, 1, 2-3, 4-7, 8-15, 16-31, 32-63, 64 and more
+    std::array<uint64_t, 8> cqe_batches{};
+    std::chrono::nanoseconds wait_time{};   // in io_uring_submit_and_wait() within run()
+    std::chrono::nanoseconds run_time{};    // the rest of run(): timers, completions, run queue
+
+    [[nodiscard]]
+    double syscalls_per_op() const noexcept {
+        return sqes ? double(submit_calls) / double(sqes) : 0;
+    }
+
+    [[nodiscard]]
+    double cqes_per_loop() const noexcept {
+        return loops ? double(cqes) / double(loops) : 0;
+    }
+
+    // average sqes handed over per io_uring_enter call, how deep the SQ gets before it is submitted
+    [[nodiscard]]
+    double sq_depth() const noexcept {
+        return submit_calls ? double(submitted) / double(submit_calls) : 0;
+    }
+
+    // share of run() spent waiting in the kernel
+    [[nodiscard]]
+    double wait_ratio() const noexcept {
+        auto total = wait_time + run_time;
+        return total.count() ? double(wait_time.count()) / double(total.count()) : 0;
+    }
+
+    // one line of counters
+    void print(FILE* out) const {
+        print(out, IOServiceStats{});
+    }
+
+    // one line of the counters gathered since `since`
+    void print(FILE* out, const IOServiceStats& since) const {
+        auto d = [](uint64_t now, uint64_t then) { return (unsigned long long)(now - then); };
+        IOServiceStats delta = *this;
+        delta.sqes -= since.sqes;
+        delta.submitted -= since.submitted;
+        delta.submit_calls -= since.submit_calls;
+        delta.loops -= since.loops;
+        delta.cqes -= since.cqes;
+        delta.wait_time -= since.wait_time;
+        delta.run_time -= since.run_time;
+        fprintf(out, "sqes %llu, syscalls/op %.3f, sq depth %.1f, loops %llu, waits %llu, cqes/loop %.1f "
+            "[0:%llu 1:%llu 2:%llu 4:%llu 8:%llu 16:%llu 32:%llu 64+:%llu], wait %.0f%%, run %.3fs, "
+            "sq full %llu, backlogged %llu, busy %llu, cq held %llu, cq dropped %llu\n",
+            d(sqes, since.sqes), delta.syscalls_per_op(), delta.sq_depth(), d(loops, since.loops),
+            d(waits, since.waits), delta.cqes_per_loop(),
+            d(cqe_batches[0], since.cqe_batches[0]), d(cqe_batches[1], since.cqe_batches[1]),
+            d(cqe_batches[2], since.cqe_batches[2]), d(cqe_batches[3], since.cqe_batches[3]),
+            d(cqe_batches[4], since.cqe_batches[4]), d(cqe_batches[5], since.cqe_batches[5]),
+            d(cqe_batches[6], since.cqe_batches[6]), d(cqe_batches[7], since.cqe_batches[7]),
+            delta.wait_ratio() * 100, std::chrono::duration<double>(delta.run_time).count(),
+            d(sq_full, since.sq_full), d(backlogged, since.backlogged), d(busy, since.busy),
+            d(cq_held, since.cq_held), d(cq_overflows, since.cq_overflows));
+    }
+};
+
+// A slot of the ring's registered file table, see IOService::register_file_table(). Ops on it
+// skip the fdget()/fdput() the kernel does for every op on a plain fd.
+struct FixedFd {
+	explicit FixedFd(unsigned index) noexcept : index(index) {}
+
+	unsigned index;
+};
+
+// The file an I/O wrapper works on: a plain fd or a FixedFd, which sets IOSQE_FIXED_FILE
+struct FileRef {
+	FileRef(int fd) noexcept : fd(fd) {}
+	FileRef(FixedFd file) noexcept : fd(int(file.index)), fixed(true) {}
+
+	[[nodiscard]]
+	uint8_t sqe_flags() const noexcept {
+		return fixed ? IOSQE_FIXED_FILE : 0;
+	}
+
+	// splice() and tee() flag a fixed input file in the op flags instead
+	[[nodiscard]]
+	unsigned splice_flags() const noexcept {
+		return fixed ? SPLICE_F_FD_IN_FIXED : 0;
+	}
+
+	int fd;
+	bool fixed = false;
+};
+
 class IOService {
 public:
-    IOService(int entries = 64, uint32_t flags = 0, uint32_t wq_fd = 0) {
+    // With IORING_SETUP_SQPOLL in `flags` a kernel thread consumes the SQ, so submitting costs no
+    // syscall while it is awake; it goes to sleep after `sq_thread_idle` ms without work and is
+    // pinned to `sq_thread_cpu` if non-negative. A non-zero `wq_fd` is the ring fd of another
+    // SQPOLL ring whose thread (and async workers) this ring shares.
+    IOService(
+        int entries = 64,
+        uint32_t flags = 0,
+        uint32_t wq_fd = 0,
+        unsigned sq_thread_idle = 0,
+        int sq_thread_cpu = -1
+    )
+#ifdef LIBURING_LATENCY_HISTOGRAM
+        // room for about as many ops in flight as the CQ holds
+        : latency_(size_t(entries) * 2)
+#endif
+    {
         io_uring_params p{
             .flags = flags,
+            .sq_thread_cpu = sq_thread_cpu >= 0 ? uint32_t(sq_thread_cpu) : 0,
+            .sq_thread_idle = sq_thread_idle,
             .wq_fd = wq_fd, // shared SQPOLL thread by rings
         };
+        if (sq_thread_cpu >= 0) p.flags |= IORING_SETUP_SQ_AFF;
+        if (wq_fd) p.flags |= IORING_SETUP_ATTACH_WQ;
 
         io_uring_queue_init_params(entries, &ring_, &p) | PanicOnErr("queue_init_params", false).use_errno;
 
@@ -89,9 +243,19 @@ public:
 	TEST_IORING_OP(IORING_OP_URING_CMD);
 	TEST_IORING_OP(IORING_OP_SEND_ZC);
 	TEST_IORING_OP(IORING_OP_SENDMSG_ZC);
+
+		if (!current_) {
+			current_ = this;
+		}
+#ifdef LIBURING_TRACE
+		trace::Registry::get().attach();
+#endif
     }
 
 	~IOService() noexcept {
+		if (current_ == this) {
+			current_ = nullptr;
+		}
 		io_uring_queue_exit(&ring_);
 	}
 
@@ -100,19 +264,19 @@ public:
 public:
 	// read data into multiple buffers asynchronously
 	SqeAwaitable readv(
-		int fd,
+		FileRef fd,
 		const iovec* iovecs,
 		unsigned nr_vecs,
 		off_t offset,
 		uint8_t iflags = 0
 	) noexcept {
 		auto* sqe = io_uring_get_sqe_safe();
-		io_uring_prep_readv(sqe, fd, iovecs, nr_vecs, offset);
-		return AwaitWork(sqe, iflags);
+		io_uring_prep_readv(sqe, fd.fd, iovecs, nr_vecs, offset);
+		return AwaitWork(sqe, iflags | fd.sqe_flags());
 	}
 
 	SqeAwaitable readv2(
-		int fd,
+		FileRef fd,
 		const iovec* iovecs,
 		unsigned nr_vecs,
 		off_t offset,
@@ -120,25 +284,25 @@ public:
 		uint8_t iflags = 0
 	) noexcept {
 		auto* sqe = io_uring_get_sqe_safe();
-		io_uring_prep_readv2(sqe, fd, iovecs, nr_vecs, offset, flags);
-		return AwaitWork(sqe, iflags);
+		io_uring_prep_readv2(sqe, fd.fd, iovecs, nr_vecs, offset, flags);
+		return AwaitWork(sqe, iflags | fd.sqe_flags());
 	}
 
 	// write data into multiple buffers asynchronously
 	SqeAwaitable writev(
-		int fd,
+		FileRef fd,
 		const iovec* iovecs,
 		unsigned nr_vecs,
 		off_t offset,
 		uint8_t iflags = 0
 	) noexcept {
 		auto* sqe = io_uring_get_sqe_safe();
-		io_uring_prep_writev(sqe, fd, iovecs, nr_vecs, offset);
-		return AwaitWork(sqe, iflags);
+		io_uring_prep_writev(sqe, fd.fd, iovecs, nr_vecs, offset);
+		return AwaitWork(sqe, iflags | fd.sqe_flags());
 	}
 
 	SqeAwaitable writev2(
-		int fd,
+		FileRef fd,
 		const iovec* iovecs,
 		unsigned nr_vecs,
 		off_t offset,
@@ -146,39 +310,49 @@ public:
 		uint8_t iflags = 0
 	) noexcept {
 		auto* sqe = io_uring_get_sqe_safe();
-		io_uring_prep_writev2(sqe, fd, iovecs, nr_vecs, offset, flags);
-		return AwaitWork(sqe, iflags);
+		io_uring_prep_writev2(sqe, fd.fd, iovecs, nr_vecs, offset, flags);
+		return AwaitWork(sqe, iflags | fd.sqe_flags());
 	}
 
-	// read from a file descriptor at a given offset asynchronously
+	// read from a file descriptor at a given offset asynchronously; becomes a read_fixed when
+	// `buf` lies in a registered buffer, see register_buffers()
 	SqeAwaitable read(
-		int fd,
+		FileRef fd,
 		void* buf,
 		size_t nbytes,
 		off_t offset,
 		uint8_t iflags = 0
 	) noexcept {
 		auto* sqe = io_uring_get_sqe_safe();
-		io_uring_prep_read(sqe, fd, buf, nbytes, offset);
-		return AwaitWork(sqe, iflags);
+		if (int index = buffer_index(buf, nbytes); index >= 0) {
+			io_uring_prep_read_fixed(sqe, fd.fd, buf, unsigned(nbytes), offset, index);
+		} else {
+			io_uring_prep_read(sqe, fd.fd, buf, nbytes, offset);
+		}
+		return AwaitWork(sqe, iflags | fd.sqe_flags());
 	}
 
-	// write data to a file descriptor at a given offset asynchronously
+	// write data to a file descriptor at a given offset asynchronously; becomes a write_fixed
+	// when `buf` lies in a registered buffer, see register_buffers()
 	SqeAwaitable write(
-		int fd,
+		FileRef fd,
 		const void* buf,
 		size_t nbytes,
 		off_t offset,
 		uint8_t iflags = 0
 	) noexcept {
 		auto* sqe = io_uring_get_sqe_safe();
-		io_uring_prep_write(sqe, fd, buf, nbytes, offset);
-		return AwaitWork(sqe, iflags);
+		if (int index = buffer_index(buf, nbytes); index >= 0) {
+			io_uring_prep_write_fixed(sqe, fd.fd, buf, unsigned(nbytes), offset, index);
+		} else {
+			io_uring_prep_write(sqe, fd.fd, buf, nbytes, offset);
+		}
+		return AwaitWork(sqe, iflags | fd.sqe_flags());
 	}
 
 	// read data into a fixed buffer asynchronously
 	SqeAwaitable read_fixed(
-		int fd,
+		FileRef fd,
 		void* buf,
 		unsigned nbytes,
 		off_t offset,
@@ -187,13 +361,13 @@ public:
 	) noexcept
 	{
 		auto* sqe = io_uring_get_sqe_safe();
-		io_uring_prep_read_fixed(sqe, fd, buf, nbytes, offset, buf_index);
-		return AwaitWork(sqe, iflags);
+		io_uring_prep_read_fixed(sqe, fd.fd, buf, nbytes, offset, buf_index);
+		return AwaitWork(sqe, iflags | fd.sqe_flags());
 	}
 
 	// write data into a fixed buffer asynchronously
 	SqeAwaitable write_fixed(
-		int fd,
+		FileRef fd,
 		const void* buf,
 		size_t nbytes,
 		off_t offset,
@@ -201,93 +375,142 @@ public:
 		uint8_t iflags = 0
 	) noexcept {
 		auto* sqe = io_uring_get_sqe_safe();
-		io_uring_prep_write_fixed(sqe, fd, buf, nbytes, offset, buf_index);
-		return AwaitWork(sqe, iflags);
+		io_uring_prep_write_fixed(sqe, fd.fd, buf, nbytes, offset, buf_index);
+		return AwaitWork(sqe, iflags | fd.sqe_flags());
 	}
 
 	// synchronize a file's in-core state with storage device asynchronously
 	SqeAwaitable fsync(
-		int fd,
+		FileRef fd,
 		int fsync_flags,
 		uint8_t iflags = 0
 	) noexcept {
 		auto* sqe = io_uring_get_sqe_safe();
-		io_uring_prep_fsync(sqe, fd, fsync_flags);
-		return AwaitWork(sqe, iflags);
+		io_uring_prep_fsync(sqe, fd.fd, fsync_flags);
+		return AwaitWork(sqe, iflags | fd.sqe_flags());
 	}
 
 	// synchronize a file segement with disk asynchronously
 	SqeAwaitable sync_file_range(
-		int fd,
+		FileRef fd,
 		off64_t offset,
 		off64_t nbytes,
 		unsigned sync_range_flags,
 		uint8_t iflags = 0
 	) noexcept {
 		auto* sqe = io_uring_get_sqe_safe();
-		io_uring_prep_rw(IORING_OP_SYNC_FILE_RANGE, sqe, fd, nullptr, nbytes, sync_range_flags);
-		return AwaitWork(sqe, iflags);
+		io_uring_prep_sync_file_range(sqe, fd.fd, unsigned(nbytes), uint64_t(offset), int(sync_range_flags));
+		return AwaitWork(sqe, iflags | fd.sqe_flags());
 	}
 
 	// receive a message from a socket asynchronously
 	SqeAwaitable recvmsg(
-		int sockfd,
+		FileRef sockfd,
 		msghdr* msg,
 		uint32_t flags,
 		uint8_t iflags = 0
 	) noexcept {
 		auto* sqe = io_uring_get_sqe_safe();
-		io_uring_prep_recvmsg(sqe, sockfd, msg, flags);
-		return AwaitWork(sqe, iflags);
+		io_uring_prep_recvmsg(sqe, sockfd.fd, msg, flags);
+		return AwaitWork(sqe, iflags | sockfd.sqe_flags());
 	}
 
 	// send a message on a socket asynchronously
 	SqeAwaitable sendmsg(
-		int sockfd,
+		FileRef sockfd,
 		const msghdr* msg,
 		uint32_t flags,
 		uint8_t iflags = 0
 	) noexcept {
 		auto* sqe = io_uring_get_sqe_safe();
-		io_uring_prep_sendmsg(sqe, sockfd, msg, flags);
-		return AwaitWork(sqe, iflags);
+		io_uring_prep_sendmsg(sqe, sockfd.fd, msg, flags);
+		return AwaitWork(sqe, iflags | sockfd.sqe_flags());
 	}
 
 	// receive a message from a socket asynchronously
 	SqeAwaitable recv(
-		int sockfd,
+		FileRef sockfd,
 		void* buf,
 		unsigned nbytes,
 		uint32_t flags,
 		uint8_t iflags = 0
 	) noexcept {
 		auto* sqe = io_uring_get_sqe_safe();
-		io_uring_prep_recv(sqe, sockfd, buf, nbytes, flags);
-		return AwaitWork(sqe, iflags);
+		io_uring_prep_recv(sqe, sockfd.fd, buf, nbytes, flags);
+		return AwaitWork(sqe, iflags | sockfd.sqe_flags());
 	}
 
 	// send a message on a socket asynchronously
 	SqeAwaitable send(
-		int sockfd,
+		FileRef sockfd,
 		const void* buf,
 		unsigned nbytes,
 		uint32_t flags,
 		uint8_t iflags = 0
 	) noexcept {
 		auto* sqe = io_uring_get_sqe_safe();
-		io_uring_prep_send(sqe, sockfd, buf, nbytes, flags);
-		return AwaitWork(sqe, iflags);
+		io_uring_prep_send(sqe, sockfd.fd, buf, nbytes, flags);
+		return AwaitWork(sqe, iflags | sockfd.sqe_flags());
+	}
+
+	// send without copying `buf` into the socket, see ZeroCopyAwaitable; uses the registered
+	// buffer holding `buf` if any. Falls back to send() on kernels without IORING_OP_SEND_ZC.
+	// Pays off for large sends, small ones are cheaper to copy.
+	[[nodiscard]]
+	ZeroCopyAwaitable send_zc(
+		FileRef sockfd,
+		const void* buf,
+		size_t nbytes,
+		int flags,
+		uint8_t iflags = 0
+	) noexcept {
+		auto* sqe = io_uring_get_sqe_safe();
+		if (!probe_ops_[IORING_OP_SEND_ZC]) [[unlikely]] {
+			io_uring_prep_send(sqe, sockfd.fd, buf, nbytes, flags);
+		} else if (int index = buffer_index(buf, nbytes); index >= 0) {
+			io_uring_prep_send_zc_fixed(sqe, sockfd.fd, buf, nbytes, flags, 0, unsigned(index));
+		} else {
+			io_uring_prep_send_zc(sqe, sockfd.fd, buf, nbytes, flags, 0);
+		}
+		io_uring_sqe_set_flags(sqe, iflags | sockfd.sqe_flags());
+		++unarmed_;
+		return ZeroCopyAwaitable(*this, sqe);
+	}
+
+	// sendmsg() without copying the iovecs' memory, see send_zc()
+	[[nodiscard]]
+	ZeroCopyAwaitable sendmsg_zc(
+		FileRef sockfd,
+		const msghdr* msg,
+		uint32_t flags,
+		uint8_t iflags = 0
+	) noexcept {
+		auto* sqe = io_uring_get_sqe_safe();
+		if (!probe_ops_[IORING_OP_SENDMSG_ZC]) [[unlikely]] {
+			io_uring_prep_sendmsg(sqe, sockfd.fd, msg, flags);
+		} else {
+			io_uring_prep_sendmsg_zc(sqe, sockfd.fd, msg, flags);
+		}
+		io_uring_sqe_set_flags(sqe, iflags | sockfd.sqe_flags());
+		++unarmed_;
+		return ZeroCopyAwaitable(*this, sqe);
+	}
+
+	// whether the kernel supports `op`, an IORING_OP_* code
+	[[nodiscard]]
+	bool supports(int op) const noexcept {
+		return op >= 0 && op < IORING_OP_LAST && probe_ops_[op];
 	}
 
 	// wait for an event on a file descriptor asynchronously
 	SqeAwaitable poll(
-		int fd,
+		FileRef fd,
 		short poll_mask,
 		uint8_t iflags = 0
 	) noexcept {
 		auto* sqe = io_uring_get_sqe_safe();
-		io_uring_prep_poll_add(sqe, fd, poll_mask);
-		return AwaitWork(sqe, iflags);
+		io_uring_prep_poll_add(sqe, fd.fd, poll_mask);
+		return AwaitWork(sqe, iflags | fd.sqe_flags());
 	}
 
 	// enqueue a noop command, which eventually acts like pthread_yield when awaiting
@@ -301,27 +524,49 @@ public:
 
 	// accept a connection on a socket asynchronously
 	SqeAwaitable accept(
-		int sockfd,
+		FileRef sockfd,
 		sockaddr* addr,
 		socklen_t* addrlen,
 		int flags = 0,
 		uint8_t iflags = 0
 	) noexcept {
 		auto* sqe = io_uring_get_sqe_safe();
-		io_uring_prep_accept(sqe, sockfd, addr, addrlen, flags);
-		return AwaitWork(sqe, iflags);
+		io_uring_prep_accept(sqe, sockfd.fd, addr, addrlen, flags);
+		return AwaitWork(sqe, iflags | sockfd.sqe_flags());
+	}
+
+	// accept a connection into a free slot of the file table, see register_file_table(); yields
+	// the slot index, wrap it in a FixedFd
+	SqeAwaitable accept_direct(
+		FileRef sockfd,
+		sockaddr* addr,
+		socklen_t* addrlen,
+		int flags = 0,
+		uint8_t iflags = 0
+	) noexcept {
+		auto* sqe = io_uring_get_sqe_safe();
+		io_uring_prep_accept_direct(sqe, sockfd.fd, addr, addrlen, flags, IORING_FILE_INDEX_ALLOC);
+		return AwaitWork(sqe, iflags | sockfd.sqe_flags());
+	}
+
+	// accept connections on a socket with one multishot sqe, yielding client fds as they arrive
+	AcceptStream multishot_accept(
+		int sockfd,
+		int flags = 0
+	) noexcept {
+		return AcceptStream(*this, sockfd, flags);
 	}
 
 	// initiate a connection on a socket asynchronously
 	SqeAwaitable connect(
-		int sockfd,
+		FileRef sockfd,
 		const sockaddr* addr,
 		socklen_t addrlen,
 		uint8_t iflags = 0
 	) noexcept {
 		auto* sqe = io_uring_get_sqe_safe();
-		io_uring_prep_connect(sqe, sockfd, addr, addrlen);
-		return AwaitWork(sqe, iflags);
+		io_uring_prep_connect(sqe, sockfd.fd, addr, addrlen);
+		return AwaitWork(sqe, iflags | sockfd.sqe_flags());
 	}
 
 	// wait for specified duration asynchronously
@@ -334,6 +579,19 @@ public:
 		return AwaitWork(sqe, iflags);
 	}
 
+	// suspend until `deadline` on the timer wheel, see SleepAwaitable; unlike timeout(), no sqe
+	// per sleep: one kernel timeout covers the nearest deadline of all timers
+	[[nodiscard]]
+	SleepAwaitable sleep_until(std::chrono::steady_clock::time_point deadline) noexcept {
+		return SleepAwaitable(*this, deadline);
+	}
+
+	template <typename Rep, typename Period>
+	[[nodiscard]]
+	SleepAwaitable sleep_for(std::chrono::duration<Rep, Period> duration) noexcept {
+		return sleep_until(std::chrono::steady_clock::now() + duration);
+	}
+
 	// open and possibly create a file asynchronously
 	SqeAwaitable open(
 		int dfd,
@@ -347,6 +605,20 @@ public:
 		return AwaitWork(sqe, iflags);
 	}
 
+	// open a file into a free slot of the file table, see register_file_table(); yields the slot
+	// index, wrap it in a FixedFd
+	SqeAwaitable open_direct(
+		int dfd,
+		const char* path,
+		int flags,
+		mode_t mode = 0,
+		uint8_t iflags = 0
+	) noexcept {
+		auto* sqe = io_uring_get_sqe_safe();
+		io_uring_prep_openat_direct(sqe, dfd, path, flags, mode, IORING_FILE_INDEX_ALLOC);
+		return AwaitWork(sqe, iflags);
+	}
+
 	// close a file descriptor asynchronously
 	SqeAwaitable close(
 		int fd,
@@ -357,6 +629,43 @@ public:
 		return AwaitWork(sqe, iflags);
 	}
 
+	// release a slot of the file table, closing the file it holds
+	SqeAwaitable close(
+		FixedFd file,
+		uint8_t iflags = 0
+	) noexcept {
+		auto* sqe = io_uring_get_sqe_safe();
+		io_uring_prep_close_direct(sqe, file.index);
+		return AwaitWork(sqe, iflags);
+	}
+
+	// create a socket asynchronously
+	SqeAwaitable socket(
+		int domain,
+		int type,
+		int protocol,
+		unsigned flags = 0,
+		uint8_t iflags = 0
+	) noexcept {
+		auto* sqe = io_uring_get_sqe_safe();
+		io_uring_prep_socket(sqe, domain, type, protocol, flags);
+		return AwaitWork(sqe, iflags);
+	}
+
+	// create a socket in a free slot of the file table, see register_file_table(); yields the
+	// slot index, wrap it in a FixedFd
+	SqeAwaitable socket_direct(
+		int domain,
+		int type,
+		int protocol,
+		unsigned flags = 0,
+		uint8_t iflags = 0
+	) noexcept {
+		auto* sqe = io_uring_get_sqe_safe();
+		io_uring_prep_socket_direct_alloc(sqe, domain, type, protocol, flags);
+		return AwaitWork(sqe, iflags);
+	}
+
 	// get file status asynchronously
 	SqeAwaitable stat(
 		int dfd,
@@ -373,41 +682,41 @@ public:
 
 	// splice data to/from a pipe asynchronously
 	SqeAwaitable splice(
-		int fd_in,
+		FileRef fd_in,
 		loff_t off_in,
-		int fd_out,
+		FileRef fd_out,
 		loff_t off_out,
 		size_t nbytes,
 		unsigned flags,
 		uint8_t iflags = 0
 	) noexcept {
 		auto* sqe = io_uring_get_sqe_safe();
-		io_uring_prep_splice(sqe, fd_in, off_in, fd_out, off_out, nbytes, flags);
-		return AwaitWork(sqe, iflags);
+		io_uring_prep_splice(sqe, fd_in.fd, off_in, fd_out.fd, off_out, nbytes, flags | fd_in.splice_flags());
+		return AwaitWork(sqe, iflags | fd_out.sqe_flags());
 	}
 
 	// duplicate pipe content asynchronously
 	SqeAwaitable tee(
-		int fd_in,
-		int fd_out,
+		FileRef fd_in,
+		FileRef fd_out,
 		size_t nbytes,
 		unsigned flags,
 		uint8_t iflags = 0
 	) noexcept {
 		auto* sqe = io_uring_get_sqe_safe();
-		io_uring_prep_tee(sqe, fd_in, fd_out, nbytes, flags);
-		return AwaitWork(sqe, iflags);
+		io_uring_prep_tee(sqe, fd_in.fd, fd_out.fd, nbytes, flags | fd_in.splice_flags());
+		return AwaitWork(sqe, iflags | fd_out.sqe_flags());
 	}
 
 	// shut down part of a full-duplex connection asynchronously
 	SqeAwaitable shutdown(
-		int sockfd,
+		FileRef sockfd,
 		int how,
 		uint8_t iflags = 0
 	) noexcept {
 		auto* sqe = io_uring_get_sqe_safe();
-		io_uring_prep_shutdown(sqe, sockfd, how);
-		return AwaitWork(sqe, iflags);
+		io_uring_prep_shutdown(sqe, sockfd.fd, how);
+		return AwaitWork(sqe, iflags | sockfd.sqe_flags());
 	}
 
 	// change the name or location of a file asynchronously
@@ -491,58 +800,295 @@ private:
 		uint8_t iflags
 	) noexcept {
 		io_uring_sqe_set_flags(sqe, iflags);
-		return SqeAwaitable{sqe};
+		++unarmed_;
+		return SqeAwaitable{*this, sqe};
 	}
 
 public:
-	// get a sqe pointer that can never be null
+	// Get a sqe pointer that can never be null. When the SQ is full and submitting doesn't make
+	// room, e.g. while the kernel refuses submissions with -EBUSY until overflowed cqes are reaped,
+	// the sqe is parked in a backlog instead, which run() moves into the SQ as completions free
+	// it up. Once the backlog has entries every new sqe queues behind them, keeping their order.
+	// A backlogged sqe stays put until its user_data is set, an awaitable may still write to it.
 	[[nodiscard]]
 	io_uring_sqe* io_uring_get_sqe_safe() noexcept { 
-		auto* sqe = io_uring_get_sqe(&ring_);
-		if (!!sqe) [[likely]] {
-			return sqe;
-		} else {
+		++stats_.sqes;
+		if (backlog_.empty() && !spill_) [[likely]] {
+			if (auto* sqe = io_uring_get_sqe(&ring_)) [[likely]] {
+				return last_sqe_ = sqe;
+			}
 			printf_if_verbose(__FILE__ ": SQ is full, flusing %u cqe(s)\n", cqe_count_);
+			++stats_.sq_full;
+			if (unarmed_) {
+				// flushing would submit sqes whose user_data isn't set yet
+				return last_sqe_ = backlog_sqe();
+			}
 			io_uring_cq_advance(&ring_, cqe_count_);
 			cqe_count_ = 0;
-			io_uring_submit(&ring_);
-			sqe = io_uring_get_sqe(&ring_);
+			flush();
+			if (sqpoll()) {
+				// the poller thread may not have caught up yet
+				++stats_.submit_calls;
+				io_uring_sqring_wait(&ring_);
+			}
+			if (auto* sqe = io_uring_get_sqe(&ring_)) [[likely]] {
+				return last_sqe_ = sqe;
+			}
+		}
+		return last_sqe_ = backlog_sqe();
+	}
+
+	// sqes waiting for room in the SQ, see io_uring_get_sqe_safe()
+	[[nodiscard]]
+	size_t backlog() const noexcept {
+		return backlog_.size();
+	}
+
+	// submit every prepared sqe right now, regardless of the submit policy
+	int flush() noexcept {
+		pending_since_ = {};
+		if (!io_uring_sq_ready(&ring_)) {
+			return 0;
+		}
+		count_enter(0);
+		++stats_.flushes;
+#ifdef LIBURING_LATENCY_HISTOGRAM
+		stamp_submissions();
+#endif
+		int r = io_uring_submit(&ring_);
+		if (r > 0) [[likely]] {
+			stats_.submitted += unsigned(r);
+		} else if (r == -EBUSY || r == -EAGAIN) {
+			++stats_.busy;
+		}
+		return r;
+	}
+
+	// make room for `n` sqes prepared back to back, so a link chain never straddles a flush
+	void reserve_sqes(unsigned n) noexcept {
+		if (!backlog_.empty() || io_uring_sq_space_left(&ring_) >= n) [[likely]] {
+			return;
+		}
+		if (unarmed_) {
+			// see io_uring_get_sqe_safe()
+			spill_ = true;
+			return;
+		}
+		io_uring_cq_advance(&ring_, cqe_count_);
+		cqe_count_ = 0;
+		flush();
+		while (sqpoll() && io_uring_sq_space_left(&ring_) < n) {
+			++stats_.submit_calls;
+			io_uring_sqring_wait(&ring_);
+		}
+		// still no room: the whole chain goes to the backlog
+		spill_ = io_uring_sq_space_left(&ring_) < n;
+	}
 
-			if (!!sqe) [[likely]] {
-				return sqe;
-			} else {
-				Panic("io_uring_get_sqe", ENOMEM);
+	// whether the SQ is consumed by a kernel thread, see the constructor
+	[[nodiscard]]
+	bool sqpoll() const noexcept {
+		return ring_.flags & IORING_SETUP_SQPOLL;
+	}
+
+	// pick when prepared sqes are handed to the kernel, see SubmitPolicy
+	void set_submit_policy(
+		SubmitPolicy policy,
+		unsigned batch = 32,
+		std::chrono::microseconds budget = std::chrono::microseconds(50)
+	) noexcept {
+		submit_policy_ = policy;
+		submit_batch_ = batch;
+		submit_budget_ = budget;
+	}
+
+	[[nodiscard]]
+	const IOServiceStats& stats() const noexcept {
+		return stats_;
+	}
+
+	// print the counters gathered since the last dump to `out` every `interval`, checked as run()
+	// loops: an idle ring stays quiet. A null `out` stops the dumps.
+	void set_stats_dump(std::chrono::milliseconds interval, FILE* out = stderr) noexcept {
+		stats_dump_ = {interval, out};
+		stats_dumped_at_ = std::chrono::steady_clock::now();
+		stats_at_dump_ = stats_;
+	}
+
+#ifdef LIBURING_LATENCY_HISTOGRAM
+	// add the submit-to-completion latencies recorded so far, per opcode, to `out`; callable
+	// from any thread, so one snapshot can gather all rings of a process
+	void latency_snapshot(LatencySnapshot& out) const {
+		latency_.snapshot(out);
+	}
+#endif
+
+	// called once an sqe carries its user_data, which is when it may be submitted
+	void sqe_armed() noexcept {
+		if (submit_policy_ == SubmitPolicy::per_loop) [[likely]] {
+			return;
+		}
+		// a flush takes every prepared sqe, including those of awaitables not awaited yet
+		if (unarmed_) {
+			return;
+		}
+		// never split a link chain across two submissions
+		if (last_sqe_ && last_sqe_->flags & (IOSQE_IO_LINK | IOSQE_IO_HARDLINK)) {
+			return;
+		}
+
+		switch (submit_policy_) {
+		case SubmitPolicy::per_op:
+			flush();
+			break;
+		case SubmitPolicy::batch:
+			if (io_uring_sq_ready(&ring_) >= submit_batch_) flush();
+			break;
+		case SubmitPolicy::budget: {
+			auto now = std::chrono::steady_clock::now();
+			if (pending_since_ == std::chrono::steady_clock::time_point{}) {
+				pending_since_ = now;
+			} else if (now - pending_since_ >= submit_budget_) {
+				flush();
 			}
+			break;
+		}
+		default:
+			break;
+		}
+	}
+
+	// hand a completion to the resolver encoded in `user_data`, see ResolverKind
+	void dispatch(uint64_t user_data, int result, uint32_t flags) noexcept {
+		auto* resolver = reinterpret_cast<void*>(user_data & ~RESOLVER_KIND_MASK);
+		switch (ResolverKind(user_data & RESOLVER_KIND_MASK)) {
+		case ResolverKind::resume:
+			static_cast<ResumeResolver*>(resolver)->resolve(result, flags);
+			break;
+		case ResolverKind::deferred:
+			static_cast<DeferredResolver*>(resolver)->resolve(result, flags);
+			break;
+		case ResolverKind::zero_copy:
+			static_cast<ZeroCopyResolver*>(resolver)->resolve(result, flags);
+			break;
+		case ResolverKind::callback: {
+			auto* slot = static_cast<CallbackSlot*>(resolver);
+			slot->resolve(result, flags);
+			callback_pool_.release(slot);
+			break;
+		}
+		default:
+			if (resolver) {
+				static_cast<Resolver*>(resolver)->resolve(result, flags);
+			}
+			break;
 		}
 	}
 
 	// wait for an event forever, blocking
 	template <typename T, bool nothrow>
 	T run(const Task<T, nothrow>& t) noexcept(nothrow) {
+		auto* prev = std::exchange(current_, this);
+		OnScopeExit restore_current([=]() { current_ = prev; });
+		auto awake_since = std::chrono::steady_clock::now();
+
 		while (!t.done()) {
-			io_uring_submit_and_wait(&ring_, 1);
+			process_timers();
+			if (t.done()) [[unlikely]] {
+				break;
+			}
+
+			if (!backlog_.empty()) [[unlikely]] {
+				drain_backlog();
+			}
+
+			unsigned wait_nr = !run_queue_ || run_queue_->prepare_wait() ? 1 : 0;
+			if (io_uring_cq_ready(&ring_) || timers_.has_due() || !backlog_cancelled_.empty()) {
+				// completions already posted, e.g. by the SQPOLL thread: don't enter just to wait
+				wait_nr = 0;
+			}
+			count_enter(wait_nr);
+			pending_since_ = {};
+			// everything prepared goes out now, awaitables the task left behind unawaited included,
+			// e.g. the unawaited head of a link chain
+			unarmed_ = 0;
+#ifdef LIBURING_LATENCY_HISTOGRAM
+			stamp_submissions();
+#endif
+			auto entered = std::chrono::steady_clock::now();
+			stats_.run_time += entered - awake_since;
+			int submitted = io_uring_submit_and_wait(&ring_, wait_nr);
+			if (submitted > 0) [[likely]] {
+				stats_.submitted += unsigned(submitted);
+			} else if (submitted == -EBUSY || submitted == -EAGAIN) {
+				// the kernel wants overflowed cqes reaped first, which the loop below does
+				++stats_.busy;
+			}
+			awake_since = std::chrono::steady_clock::now();
+			stats_.wait_time += awake_since - entered;
+			++stats_.loops;
+			stats_.waits += wait_nr;
+			stats_.cq_overflows = IO_URING_READ_ONCE(*ring_.cq.koverflow);
+			if (IO_URING_READ_ONCE(*ring_.sq.kflags) & IORING_SQ_CQ_OVERFLOW) [[unlikely]] {
+				++stats_.cq_held;
+			}
 
 			io_uring_cqe* cqe;
 			unsigned head;
+#ifdef LIBURING_LATENCY_HISTOGRAM
+			auto completed_ns = uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+				awake_since.time_since_epoch()).count());
+#endif
 
+			unsigned handled = 0;
 			io_uring_for_each_cqe(&ring_, head, cqe) {
 				++cqe_count_;
-				auto coro = static_cast<Resolver*>(io_uring_cqe_get_data(cqe));
-				if (coro) {
-					coro->resolve(cqe->res);
-				}
+				++handled;
+#ifdef LIBURING_LATENCY_HISTOGRAM
+				latency_.completed(cqe->user_data, cqe->flags, completed_ns);
+#endif
+				dispatch(io_uring_cqe_get_data64(cqe), cqe->res, cqe->flags);
 			}
 
 			printf_if_verbose(__FILE__, ": found %u cqe(s)\n, looping...\n", cqe_count);
 
 			io_uring_cq_advance(&ring_, cqe_count_);
 			cqe_count_ = 0;
+			stats_.cqes += handled;
+			++stats_.cqe_batches[std::min(unsigned(std::bit_width(handled)), 7u)];
+			if (stats_dump_.out && awake_since - stats_dumped_at_ >= stats_dump_.interval) [[unlikely]] {
+				dump_stats(awake_since);
+			}
+
+			while (!backlog_cancelled_.empty()) [[unlikely]] {
+				uint64_t user_data = backlog_cancelled_.back();
+				backlog_cancelled_.pop_back();
+				dispatch(user_data, -ECANCELED, 0);
+			}
+
+			if (run_queue_) {
+				run_queue_->run_some();
+			}
 		}
 
 		return t.get_result();
 	}
 
 public:
+	// register an empty file table of `slots` entries, managed by the kernel: accept_direct(),
+	// open_direct() and socket_direct() take the lowest free slot, close(FixedFd) frees it.
+	// Replaces register_files(), the two don't mix.
+	void register_file_table(unsigned slots) {
+		io_uring_register_files_sparse(&ring_, slots) | PanicOnErr("io_uring_register_files_sparse", false);
+		file_table_size_ = slots;
+	}
+
+	// slots of the table registered by register_file_table(), 0 if none
+	[[nodiscard]]
+	unsigned file_table_size() const noexcept {
+		return file_table_size_;
+	}
+
 	// register files for I/O
 	void register_files(std::initializer_list<int> fds) {
 		register_files(fds.begin(), (unsigned int)fds.size());
@@ -560,6 +1106,7 @@ public:
 	// unregister files
 	void register_files_unregister() {
 		io_uring_unregister_files(&ring_);
+		file_table_size_ = 0;
 	}
 
 public:
@@ -571,22 +1118,361 @@ public:
 
 	void register_buffers(const struct iovec *iovecs, unsigned nr_iovecs) {
 		io_uring_register_buffers(&ring_, iovecs, nr_iovecs) | PanicOnErr("io_uring_register_buffers", false);
+		registered_buffers_.assign(iovecs, iovecs + nr_iovecs);
 	}
 
 	// unregister all buffers
 	int unregister_buffers() {
+		registered_buffers_.clear();
 		return io_uring_unregister_buffers(&ring_);
 	}
+
+	// index of the registered buffer holding [buf, buf + nbytes), -1 if none does
+	[[nodiscard]]
+	int buffer_index(const void* buf, size_t nbytes) const noexcept {
+		auto* p = static_cast<const char*>(buf);
+		for (size_t i = 0; i < registered_buffers_.size(); ++i) {
+			auto* base = static_cast<const char*>(registered_buffers_[i].iov_base);
+			if (p >= base && p + nbytes <= base + registered_buffers_[i].iov_len) {
+				return int(i);
+			}
+		}
+		return -1;
+	}
 public:
+	// the service driving the calling thread: the one inside run(), else the first one created
+	[[nodiscard]]
+	static IOService* current() noexcept {
+		return current_;
+	}
+
+	// let run() drain `queue` in between completions, nullptr detaches it
+	void set_run_queue(RunQueue* queue) noexcept {
+		run_queue_ = queue;
+	}
+
 	// return internal io_uring_handle
 	[[nodiscard]]
 	io_uring& get_handle() noexcept {
 		return ring_;
 	}
 private:
+	friend class SleepAwaitable;
+	friend class Timer;
+
+	// the kernel timeout armed for the wheel's nearest deadline
+	struct TimerExpiry final : public Resolver {
+		explicit TimerExpiry(IOService* self) noexcept : self(self) {}
+		IOService* self;
+
+		void resolve(int, uint32_t) noexcept override {
+			self->timer_armed_ = UINT64_MAX;
+		}
+	};
+
+	// timer wheel ticks are milliseconds since the service was created
+	[[nodiscard]]
+	uint64_t tick_of(std::chrono::steady_clock::time_point tp, bool round_up) const noexcept {
+		if (tp <= timer_epoch_) return 0;
+		auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(tp - timer_epoch_).count();
+		return uint64_t(ns / 1000000 + (round_up && ns % 1000000 ? 1 : 0));
+	}
+
+	// expire due timers, resume their waiters and make sure a kernel timeout wakes the loop up
+	// for the next one
+	void process_timers() noexcept {
+		if (timers_.empty()) [[likely]] {
+			return;
+		}
+		timers_.advance(tick_of(std::chrono::steady_clock::now(), false));
+		timers_.fire_due();
+
+		uint64_t next = timers_.empty() ? UINT64_MAX : timers_.next_tick();
+		if (next >= timer_armed_) {
+			// an earlier (maybe stale) timeout is armed already, it wakes us up in time
+			return;
+		}
+		timer_ts_ = dur2ts((timer_epoch_ + std::chrono::milliseconds(next)).time_since_epoch());
+		auto* sqe = io_uring_get_sqe_safe();
+		if (timer_armed_ == UINT64_MAX) {
+			io_uring_prep_timeout(sqe, &timer_ts_, 0, IORING_TIMEOUT_ABS);
+			io_uring_sqe_set_data(sqe, static_cast<Resolver*>(&timer_expiry_));
+		} else {
+			io_uring_prep_timeout_update(sqe, &timer_ts_,
+				reinterpret_cast<uint64_t>(static_cast<Resolver*>(&timer_expiry_)), IORING_TIMEOUT_ABS);
+			io_uring_sqe_set_data(sqe, nullptr);
+		}
+		timer_armed_ = next;
+	}
+
+	// The timeout has to be the sqe right after the op. An op prepared before others, or with no
+	// room left behind it in the SQ, is moved to a fresh pair of sqes first, leaving a nop in its
+	// place. An op in a link chain can't move, nor take a timeout before its successor: it is
+	// failed instead, and the rest of its chain with it.
+	bool link_deadline(io_uring_sqe*& sqe, __kernel_timespec& ts,
+		std::chrono::steady_clock::time_point deadline, uint64_t timeout_data) noexcept {
+		constexpr uint8_t linked = IOSQE_IO_LINK | IOSQE_IO_HARDLINK;
+		// an op in the backlog has its timeout queued right behind it
+		bool in_place = sqe == last_sqe_ && (!backlog_.empty() || io_uring_sq_space_left(&ring_));
+		if (sqe->flags & linked || (!in_place && linked_from_previous(sqe))) {
+			// reading fd -1 fails with -EBADF without touching anything
+			uint8_t flags = sqe->flags & linked;
+			io_uring_prep_read(sqe, -1, nullptr, 0, 0);
+			sqe->flags = flags;
+			return false;
+		}
+		if (!in_place) {
+			auto op = *sqe;
+			io_uring_prep_nop(sqe);
+			io_uring_sqe_set_data(sqe, nullptr);
+			reserve_sqes(2);
+			sqe = io_uring_get_sqe_safe();
+			*sqe = op;
+		}
+		ts = dur2ts(deadline.time_since_epoch());
+		sqe->flags |= IOSQE_IO_LINK;
+		auto* timeout = io_uring_get_sqe_safe();
+		io_uring_prep_link_timeout(timeout, &ts, IORING_TIMEOUT_ABS);
+		io_uring_sqe_set_data64(timeout, timeout_data);
+		return true;
+	}
+
+	// whether the unsubmitted sqe prepared right before `sqe` links to it
+	bool linked_from_previous(const io_uring_sqe* sqe) const noexcept {
+		const io_uring_sqe* prev = nullptr;
+		auto& sq = ring_.sq;
+		auto it = std::find_if(backlog_.begin(), backlog_.end(),
+			[sqe](const io_uring_sqe& entry) { return &entry == sqe; });
+		if (it != backlog_.end()) {
+			if (it != backlog_.begin()) {
+				prev = &*std::prev(it);
+			} else if (sq.sqe_tail != sq.sqe_head) {
+				prev = &sq.sqes[(sq.sqe_tail - 1) & *sq.kring_mask];
+			}
+		} else {
+			auto pos = unsigned(sqe - sq.sqes);
+			if (((pos - sq.sqe_head) & *sq.kring_mask) != 0) {
+				prev = &sq.sqes[(pos - 1) & *sq.kring_mask];
+			}
+		}
+		return prev && prev->flags & (IOSQE_IO_LINK | IOSQE_IO_HARDLINK);
+	}
+
+	void dump_stats(std::chrono::steady_clock::time_point now) noexcept {
+		fprintf(stats_dump_.out, "ring %d, last %.1fs: ", ring_.ring_fd,
+			std::chrono::duration<double>(now - stats_dumped_at_).count());
+		stats_.print(stats_dump_.out, stats_at_dump_);
+		stats_dumped_at_ = now;
+		stats_at_dump_ = stats_;
+	}
+
+#ifdef LIBURING_LATENCY_HISTOGRAM
+	static uint64_t latency_clock() noexcept {
+		return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count());
+	}
+
+	// stamp the sqes the next submit hands to the kernel, one clock read for all of them
+	void stamp_submissions() noexcept {
+		auto& sq = ring_.sq;
+		if (sq.sqe_head == sq.sqe_tail) {
+			return;
+		}
+		uint64_t now = latency_clock();
+		for (unsigned i = sq.sqe_head; i != sq.sqe_tail; ++i) {
+			latency_.submitted(&sq.sqes[i & *sq.kring_mask], now);
+		}
+	}
+#endif
+
+	// user_data of a backlogged sqe no one has set it for yet, never a valid resolver
+	static constexpr uint64_t UNARMED = RESOLVER_KIND_MASK;
+
+	io_uring_sqe* backlog_sqe() noexcept {
+		++stats_.backlogged;
+		auto& sqe = backlog_.emplace_back();
+		sqe.user_data = UNARMED;
+		return &sqe;
+	}
+
+	// Move whole link chains from the backlog into the SQ while they fit. A chain with an sqe
+	// whose awaitable hasn't set its user_data yet stays, with everything behind it.
+	void drain_backlog() noexcept {
+		while (!backlog_.empty()) {
+			size_t chain = 1;
+			while (chain <= backlog_.size() && backlog_[chain - 1].flags & (IOSQE_IO_LINK | IOSQE_IO_HARDLINK)) {
+				++chain;
+			}
+			if (chain > backlog_.size() || io_uring_sq_space_left(&ring_) < chain) {
+				break;
+			}
+			if (std::any_of(backlog_.begin(), backlog_.begin() + ptrdiff_t(chain),
+					[](const io_uring_sqe& sqe) { return sqe.user_data == UNARMED; })) {
+				break;
+			}
+			for (; chain; --chain) {
+				*io_uring_get_sqe(&ring_) = backlog_.front();
+				backlog_.pop_front();
+			}
+		}
+		if (backlog_.empty()) {
+			spill_ = false;
+		}
+	}
+
+	// Turn the backlogged chain holding the op tagged `user_data`, if any, into nops: the kernel
+	// hasn't seen it, so can't cancel it. Its ops complete with -ECANCELED from run() instead.
+	bool cancel_backlogged(uint64_t user_data) noexcept {
+		for (size_t begin = 0, end; begin < backlog_.size(); begin = end) {
+			end = begin + 1;
+			while (end <= backlog_.size() && backlog_[end - 1].flags & (IOSQE_IO_LINK | IOSQE_IO_HARDLINK)) {
+				++end;
+			}
+			end = std::min(end, backlog_.size());
+			for (size_t i = begin; i < end; ++i) {
+				if (backlog_[i].user_data != user_data) {
+					continue;
+				}
+				// entries stay put, later ones may still be getting their user_data
+				for (size_t j = begin; j < end; ++j) {
+					uint64_t data = backlog_[j].user_data;
+					io_uring_prep_nop(&backlog_[j]);
+					if (data == UNARMED) {
+						// still held by its awaitable, which sets the user_data of the nop
+						continue;
+					}
+					backlog_cancelled_.push_back(data);
+					io_uring_sqe_set_data(&backlog_[j], nullptr);
+				}
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// account for the io_uring_enter call liburing is about to make, if any: submitting takes one
+	// unless a woken SQPOLL thread does it, waiting always does
+	void count_enter(unsigned wait_nr) noexcept {
+		if (sqpoll()) {
+			bool wakeup = io_uring_sq_ready(&ring_) && IO_URING_READ_ONCE(*ring_.sq.kflags) & IORING_SQ_NEED_WAKEUP;
+			stats_.wakeups += wakeup;
+			stats_.submit_calls += wakeup || wait_nr;
+		} else {
+			stats_.submit_calls += wait_nr || io_uring_sq_ready(&ring_);
+		}
+	}
+
     io_uring ring_;
     unsigned cqe_count_{};
     bool probe_ops_[IORING_OP_LAST] = {};
+    RunQueue* run_queue_ = nullptr;
+    io_uring_sqe* last_sqe_ = nullptr;
+    SubmitPolicy submit_policy_ = SubmitPolicy::per_loop;
+    unsigned submit_batch_ = 32;
+    std::chrono::microseconds submit_budget_{50};
+    std::chrono::steady_clock::time_point pending_since_{};
+    IOServiceStats stats_{};
+    struct {
+        std::chrono::milliseconds interval{};
+        FILE* out = nullptr;
+    } stats_dump_;                              // see set_stats_dump()
+    std::chrono::steady_clock::time_point stats_dumped_at_{};
+    IOServiceStats stats_at_dump_{};
+    CallbackPool callback_pool_;
+    unsigned file_table_size_ = 0;
+    std::vector<iovec> registered_buffers_;     // looked up by read()/write(), few regions
+    TimerWheel timers_;
+    std::chrono::steady_clock::time_point timer_epoch_ = std::chrono::steady_clock::now();
+    __kernel_timespec timer_ts_{};
+    uint64_t timer_armed_ = UINT64_MAX;     // tick the kernel timeout is armed for
+    TimerExpiry timer_expiry_{this};
+    std::deque<io_uring_sqe> backlog_;          // see io_uring_get_sqe_safe()
+    std::vector<uint64_t> backlog_cancelled_;   // dropped from the backlog, see cancel_backlogged()
+    bool spill_ = false;                        // a reserved chain didn't fit, see reserve_sqes()
+    unsigned unarmed_ = 0;                      // sqes of awaitables without user_data yet, see sqe_armed()
+#ifdef LIBURING_LATENCY_HISTOGRAM
+    OpLatency latency_;
+#endif
+    friend void on_sqe_armed(IOService& service) noexcept;
+    friend CallbackPool& callback_pool(IOService& service) noexcept;
+    friend void cancel_user_data(IOService& service, uint64_t user_data) noexcept;
+    friend bool link_deadline(IOService& service, io_uring_sqe*& sqe, __kernel_timespec& ts,
+        std::chrono::steady_clock::time_point deadline, uint64_t timeout_data) noexcept;
+    inline static thread_local IOService* current_ = nullptr;
 };
 
+inline void on_sqe_armed(IOService& service) noexcept {
+	service.unarmed_ -= service.unarmed_ > 0;
+	service.sqe_armed();
+}
+
+inline CallbackPool& callback_pool(IOService& service) noexcept {
+	return service.callback_pool_;
+}
+
+inline bool link_deadline(IOService& service, io_uring_sqe*& sqe, __kernel_timespec& ts,
+	std::chrono::steady_clock::time_point deadline, uint64_t timeout_data) noexcept {
+	return service.link_deadline(sqe, ts, deadline, timeout_data);
+}
+
+inline void cancel_user_data(IOService& service, uint64_t user_data) noexcept {
+	if (!service.backlog_.empty() && service.cancel_backlogged(user_data)) [[unlikely]] {
+		return;
+	}
+	auto* sqe = service.io_uring_get_sqe_safe();
+	io_uring_prep_cancel64(sqe, user_data, 0);
+	io_uring_sqe_set_data(sqe, nullptr);
+	service.sqe_armed();
+}
+
+inline SleepAwaitable::~SleepAwaitable() {
+	service_->timers_.remove(node_);
+	if (owner_ && owner_->active_ == this) {
+		owner_->active_ = nullptr;
+	}
+}
+
+inline void SleepAwaitable::await_suspend(std::coroutine_handle<> handle) noexcept {
+	node_.handle = handle;
+	service_->timers_.insert(node_, service_->tick_of(deadline_, true));
+	if (owner_) {
+		owner_->active_ = this;
+	}
+	if (cancelled_) [[unlikely]] {
+		service_->timers_.cancel(node_);
+	}
+}
+
+inline void SleepAwaitable::cancel() noexcept {
+	cancelled_ = true;
+	service_->timers_.cancel(node_);
+}
+
+inline int SleepAwaitable::await_resume() noexcept {
+	if (owner_ && owner_->active_ == this) {
+		owner_->active_ = nullptr;
+	}
+	return node_.result;
+}
+
+inline bool Timer::cancel() noexcept {
+	return active_ && service_->timers_.cancel(active_->node_);
+}
+
+inline void AcceptState::arm() noexcept {
+	auto* sqe = service_->io_uring_get_sqe_safe();
+	if (multishot_) {
+		io_uring_prep_multishot_accept(sqe, sockfd_, nullptr, nullptr, flags_);
+	} else {
+		io_uring_prep_accept(sqe, sockfd_, nullptr, nullptr, flags_);
+	}
+	io_uring_sqe_set_data(sqe, this);
+	armed_ = true;
+}
+
+// the multishot may still wait in the backlog, which cancel_user_data() takes care of
+inline void AcceptState::cancel() noexcept {
+	cancel_user_data(*service_, reinterpret_cast<uint64_t>(static_cast<Resolver*>(this)));
+}
+
 }
\ No newline at end of file
@@ -0,0 +1,316 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <cstdio>
+#include <iterator>
+#include <memory>
+#include <vector>
+#include <liburing.h>
+
+namespace coro {
+
+// Log-linear (HDR style) latency histogram in nanoseconds: exact below 2^SUB_BITS, then
+// 2^SUB_BITS buckets per power of two, so a bucket is within ~3% of any value it holds. Values
+// from 2^MAX_EXP ns (~9 minutes) up land in the last bucket. Plain counters, see
+// AtomicLatencyHistogram for one recorded while others read it.
+class LatencyHistogram {
+public:
+    static constexpr unsigned SUB_BITS = 5;
+    static constexpr unsigned SUB_BUCKETS = 1u << SUB_BITS;
+    static constexpr unsigned MAX_EXP = 39;
+    static constexpr unsigned BUCKETS = (MAX_EXP - SUB_BITS + 2) * SUB_BUCKETS;
+
+    [[nodiscard]]
+    static constexpr unsigned bucket_of(uint64_t ns) noexcept {
+        if (ns < SUB_BUCKETS) {
+            return unsigned(ns);
+        }
+        unsigned exp = unsigned(std::bit_width(ns)) - 1;
+        if (exp > MAX_EXP) {
+            return BUCKETS - 1;
+        }
+        unsigned shift = exp - SUB_BITS;
+        return (shift + 1) * SUB_BUCKETS + unsigned(ns >> shift) - SUB_BUCKETS;
+    }
+
+    // the highest value bucket `b` holds
+    [[nodiscard]]
+    static constexpr uint64_t bucket_value(unsigned b) noexcept {
+        if (b < SUB_BUCKETS) {
+            return b;
+        }
+        unsigned shift = b / SUB_BUCKETS - 1;
+        uint64_t mantissa = SUB_BUCKETS + b % SUB_BUCKETS;
+        return ((mantissa + 1) << shift) - 1;
+    }
+
+    void record(uint64_t ns) noexcept {
+        ++counts_[bucket_of(ns)];
+        ++count_;
+        sum_ += ns;
+        max_ = std::max(max_, ns);
+    }
+
+    LatencyHistogram& operator+=(const LatencyHistogram& other) noexcept {
+        for (unsigned b = 0; b < BUCKETS; ++b) {
+            counts_[b] += other.counts_[b];
+        }
+        count_ += other.count_;
+        sum_ += other.sum_;
+        max_ = std::max(max_, other.max_);
+        return *this;
+    }
+
+    // the value `q` (0..1) of the recorded values are at or below, e.g. 0.999 for p999
+    [[nodiscard]]
+    uint64_t quantile(double q) const noexcept {
+        if (!count_) {
+            return 0;
+        }
+        auto rank = uint64_t(q * double(count_ - 1)) + 1;
+        uint64_t seen = 0;
+        for (unsigned b = 0; b < BUCKETS; ++b) {
+            seen += counts_[b];
+            if (seen >= rank) {
+                return std::min(bucket_value(b), max_);
+            }
+        }
+        return max_;
+    }
+
+    [[nodiscard]]
+    uint64_t count() const noexcept {
+        return count_;
+    }
+
+    [[nodiscard]]
+    uint64_t max() const noexcept {
+        return max_;
+    }
+
+    [[nodiscard]]
+    double mean() const noexcept {
+        return count_ ? double(sum_) / double(count_) : 0;
+    }
+
+private:
+    friend class AtomicLatencyHistogram;
+
+    std::array<uint64_t, BUCKETS> counts_{};
+    uint64_t count_ = 0;
+    uint64_t sum_ = 0;
+    uint64_t max_ = 0;
+};
+
+// A LatencyHistogram written by one thread and copied out by any: counters are relaxed atomics
+// the writer bumps with plain loads and stores, no read-modify-write.
+class AtomicLatencyHistogram {
+public:
+    void record(uint64_t ns) noexcept {
+        bump(counts_[LatencyHistogram::bucket_of(ns)], 1);
+        bump(count_, 1);
+        bump(sum_, ns);
+        if (ns > max_.load(std::memory_order_relaxed)) {
+            max_.store(ns, std::memory_order_relaxed);
+        }
+    }
+
+    // add the counts so far to `out`; a record() running meanwhile may be seen in part
+    void snapshot(LatencyHistogram& out) const noexcept {
+        for (unsigned b = 0; b < LatencyHistogram::BUCKETS; ++b) {
+            out.counts_[b] += counts_[b].load(std::memory_order_relaxed);
+        }
+        out.count_ += count_.load(std::memory_order_relaxed);
+        out.sum_ += sum_.load(std::memory_order_relaxed);
+        out.max_ = std::max(out.max_, max_.load(std::memory_order_relaxed));
+    }
+
+private:
+    static void bump(std::atomic<uint64_t>& counter, uint64_t n) noexcept {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    std::array<std::atomic<uint64_t>, LatencyHistogram::BUCKETS> counts_{};
+    std::atomic<uint64_t> count_{0};
+    std::atomic<uint64_t> sum_{0};
+    std::atomic<uint64_t> max_{0};
+};
+
+// name of an io_uring opcode, for reports
+[[nodiscard]]
+inline const char* opcode_name(unsigned opcode) noexcept {
+    static constexpr const char* names[] = {
+        "nop", "readv", "writev", "fsync", "read_fixed", "write_fixed", "poll_add", "poll_remove",
+        "sync_file_range", "sendmsg", "recvmsg", "timeout", "timeout_remove", "accept",
+        "async_cancel", "link_timeout", "connect", "fallocate", "openat", "close", "files_update",
+        "statx", "read", "write", "fadvise", "madvise", "send", "recv", "openat2", "epoll_ctl",
+        "splice", "provide_buffers", "remove_buffers", "tee", "shutdown", "renameat", "unlinkat",
+        "mkdirat", "symlinkat", "linkat", "msg_ring", "fsetxattr", "setxattr", "fgetxattr",
+        "getxattr", "socket", "uring_cmd", "send_zc", "sendmsg_zc",
+    };
+    static_assert(std::size(names) == IORING_OP_SENDMSG_ZC + 1);
+    return opcode < std::size(names) ? names[opcode] : "unknown";
+}
+
+// Submit-to-completion latency per opcode, merged from any number of rings, see
+// IOService::latency_snapshot()
+struct LatencySnapshot {
+    std::array<std::unique_ptr<LatencyHistogram>, IORING_OP_LAST> ops;
+    uint64_t untracked = 0;     // ops submitted while the table of ops in flight was full
+
+    // the histogram of `opcode`, created empty on first use
+    LatencyHistogram& op(unsigned opcode) {
+        auto& h = ops[opcode];
+        if (!h) {
+            h = std::make_unique<LatencyHistogram>();
+        }
+        return *h;
+    }
+
+    LatencySnapshot& operator+=(const LatencySnapshot& other) {
+        for (unsigned opcode = 0; opcode < IORING_OP_LAST; ++opcode) {
+            if (other.ops[opcode]) {
+                op(opcode) += *other.ops[opcode];
+            }
+        }
+        untracked += other.untracked;
+        return *this;
+    }
+
+    // one line per opcode seen: count, mean, p50, p99, p999 and max in microseconds
+    void print(FILE* out = stdout) const {
+        fprintf(out, "%-16s %10s %10s %10s %10s %10s %10s\n", "op", "count", "mean us", "p50 us", "p99 us", "p999 us", "max us");
+        for (unsigned opcode = 0; opcode < IORING_OP_LAST; ++opcode) {
+            auto& h = ops[opcode];
+            if (!h || !h->count()) {
+                continue;
+            }
+            fprintf(out, "%-16s %10llu %10.1f %10.1f %10.1f %10.1f %10.1f\n", opcode_name(opcode),
+                (unsigned long long)h->count(), h->mean() / 1e3, double(h->quantile(0.5)) / 1e3,
+                double(h->quantile(0.99)) / 1e3, double(h->quantile(0.999)) / 1e3, double(h->max()) / 1e3);
+        }
+        if (untracked) {
+            fprintf(out, "%llu op(s) not tracked\n", (unsigned long long)untracked);
+        }
+    }
+};
+
+// What an IOService records with LIBURING_LATENCY_HISTOGRAM: ops in flight by user_data, stamped
+// when submitted, and one AtomicLatencyHistogram per opcode. Everything is allocated up front,
+// recording never allocates: ops submitted while the table is half full are not tracked.
+// A multishot op records each cqe against the previous one, the time it waited for that event;
+// a zero-copy send records its result, not the notification that the buffer is free again.
+// Only the ring's thread records; snapshot() may run anywhere.
+class OpLatency {
+public:
+    explicit OpLatency(size_t in_flight = 128) : slots_(std::bit_ceil(std::max<size_t>(in_flight, 128) * 2)) {
+        for (auto& h : histograms_) {
+            h.store(new AtomicLatencyHistogram(), std::memory_order_relaxed);
+        }
+    }
+
+    ~OpLatency() {
+        for (auto& h : histograms_) {
+            delete h.load(std::memory_order_relaxed);
+        }
+    }
+
+    OpLatency(const OpLatency&) = delete;
+    OpLatency& operator=(const OpLatency&) = delete;
+
+    // the sqes about to be submitted; internal ones without user_data and those posting no cqe on
+    // success aren't tracked
+    void submitted(const io_uring_sqe* sqe, uint64_t now_ns) noexcept {
+        if (!sqe->user_data || sqe->flags & IOSQE_CQE_SKIP_SUCCESS) {
+            return;
+        }
+        if ((size_ + 1) * 2 > slots_.size()) [[unlikely]] {
+            untracked_.store(untracked_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return;
+        }
+        auto& slot = find(sqe->user_data);
+        if (!slot.user_data) {
+            ++size_;
+        }
+        slot = {sqe->user_data, now_ns, sqe->opcode};
+    }
+
+    void completed(uint64_t user_data, uint32_t flags, uint64_t now_ns) noexcept {
+        if (!user_data) {
+            return;
+        }
+        auto& slot = find(user_data);
+        if (!slot.user_data) {
+            return;
+        }
+        if (!(flags & IORING_CQE_F_NOTIF)) {
+            histograms_[slot.opcode].load(std::memory_order_relaxed)->record(
+                now_ns > slot.start_ns ? now_ns - slot.start_ns : 0);
+        }
+        if (flags & IORING_CQE_F_MORE) {
+            slot.start_ns = now_ns;
+        } else {
+            erase(slot);
+        }
+    }
+
+    void snapshot(LatencySnapshot& out) const {
+        for (unsigned opcode = 0; opcode < IORING_OP_LAST; ++opcode) {
+            auto* h = histograms_[opcode].load(std::memory_order_relaxed);
+            LatencyHistogram recorded;
+            h->snapshot(recorded);
+            if (recorded.count()) {
+                out.op(opcode) += recorded;
+            }
+        }
+        out.untracked += untracked_.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Slot {
+        uint64_t user_data = 0;     // 0 when free
+        uint64_t start_ns = 0;
+        uint8_t opcode = 0;
+    };
+
+    size_t index(uint64_t user_data) const noexcept {
+        // user_data are mostly pointers, mix the bits above the alignment in
+        return size_t((user_data * 0x9E3779B97F4A7C15ull) >> 32) & (slots_.size() - 1);
+    }
+
+    // linear probing: the slot holding `user_data` or the free one it would go to
+    Slot& find(uint64_t user_data) noexcept {
+        for (size_t i = index(user_data);; i = (i + 1) & (slots_.size() - 1)) {
+            if (slots_[i].user_data == user_data || !slots_[i].user_data) {
+                return slots_[i];
+            }
+        }
+    }
+
+    // backward shift deletion, no tombstones
+    void erase(Slot& slot) noexcept {
+        size_t mask = slots_.size() - 1;
+        size_t hole = size_t(&slot - slots_.data());
+        for (size_t i = (hole + 1) & mask; slots_[i].user_data; i = (i + 1) & mask) {
+            size_t home = index(slots_[i].user_data);
+            // move the entry back unless its home lies cyclically in (hole, i]
+            if (((i - home) & mask) >= ((i - hole) & mask)) {
+                slots_[hole] = slots_[i];
+                hole = i;
+            }
+        }
+        slots_[hole] = {};
+        --size_;
+    }
+
+    std::vector<Slot> slots_;
+    size_t size_ = 0;
+    std::atomic<uint64_t> untracked_{0};
+    std::array<std::atomic<AtomicLatencyHistogram*>, IORING_OP_LAST> histograms_{};
+};
+
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <cerrno>
+#include <coroutine>
+#include <deque>
+#include <utility>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <liburing.h>
+
+#include "sqe_awaitable.hpp"
+
+namespace coro {
+
+class IOService;
+
+// Shared state of one multishot accept.
+// It lives on the heap because the kernel keeps posting cqes against it (at least the final
+// -ECANCELED one) after the AcceptStream owning it is gone; it deletes itself in that case.
+struct AcceptState final : public Resolver {
+    AcceptState(IOService& service, int sockfd, int flags) noexcept
+        : service_(&service), sockfd_(sockfd), flags_(flags) {}
+
+    void resolve(int result, uint32_t flags) noexcept override {
+        if (detached_) {
+            if (result >= 0) ::close(result);
+            if (!(flags & IORING_CQE_F_MORE)) delete this;
+            return;
+        }
+
+        if (!(flags & IORING_CQE_F_MORE)) {
+            armed_ = false;
+            if (result == -EINVAL && multishot_ && !accepted_) {
+                // pre-5.19 kernel, keep going with one-shot accepts
+                multishot_ = false;
+                arm();
+                return;
+            }
+            // the kernel drops a multishot on cq overflow as well, re-arm straight away then
+            // errors are handed to the consumer instead, it re-arms by asking for the next fd
+            if (result >= 0) arm();
+        }
+
+        accepted_ |= result >= 0;
+        ready_.push_back(result);
+        if (waiter_) {
+            std::exchange(waiter_, {}).resume();
+        }
+    }
+
+    void arm() noexcept;
+    void cancel() noexcept;
+
+    IOService* service_;
+    int sockfd_;
+    int flags_;
+    bool armed_ = false;
+    bool multishot_ = true;
+    bool accepted_ = false;
+    bool detached_ = false;
+    std::deque<int> ready_;
+    std::coroutine_handle<> waiter_;
+};
+
+// An endless stream of accepted client fds backed by one IORING_ACCEPT_MULTISHOT sqe.
+// The multishot is re-armed transparently whenever the kernel terminates it.
+class AcceptStream {
+public:
+    AcceptStream(IOService& service, int sockfd, int flags = 0) noexcept
+        : state_(new AcceptState(service, sockfd, flags)) {
+        state_->arm();
+    }
+
+    AcceptStream(AcceptStream&& other) noexcept : state_(std::exchange(other.state_, nullptr)) {}
+    AcceptStream& operator=(AcceptStream&&) = delete;
+    AcceptStream(const AcceptStream&) = delete;
+    AcceptStream& operator=(const AcceptStream&) = delete;
+
+    ~AcceptStream() {
+        if (!state_) {
+            return;
+        }
+        for (int fd : state_->ready_) {
+            if (fd >= 0) ::close(fd);
+        }
+        if (state_->armed_) {
+            state_->detached_ = true;
+            state_->cancel();
+        } else {
+            delete state_;
+        }
+    }
+
+    // wait for the next accepted fd, a negative value is an errno from the kernel
+    auto next() noexcept {
+        struct AwaitAccept {
+            AcceptState* state;
+            bool cancelled = false;
+
+            bool await_ready() const noexcept {
+                return !state->ready_.empty();
+            }
+
+#ifdef LIBURING_TRACE
+            trace::Await trace() const noexcept {
+                return {"accept_multishot", "fd", state->sockfd_};
+            }
+#endif
+
+            void await_suspend(std::coroutine_handle<> handle) noexcept {
+                if (!state->armed_) state->arm();
+                state->waiter_ = handle;
+                if (cancelled) [[unlikely]] state->cancel();
+            }
+
+            // see TaskContext::cancel(); the multishot ends with -ECANCELED, the next call re-arms
+            void cancel() noexcept {
+                cancelled = true;
+                if (state->waiter_) state->cancel();
+            }
+
+            int await_resume() const noexcept {
+                int fd = state->ready_.front();
+                state->ready_.pop_front();
+                return fd;
+            }
+        };
+
+        return AwaitAccept{state_};
+    }
+
+    // number of accepted fds queued but not yet consumed
+    [[nodiscard]]
+    size_t pending() const noexcept {
+        return state_->ready_.size();
+    }
+
+private:
+    AcceptState* state_;
+};
+
+}
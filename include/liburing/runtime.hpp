@@ -0,0 +1,211 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <latch>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "io_service.hpp"
+#include "task.hpp"
+#include "utils.hpp"
+
+namespace coro {
+
+// create a listening socket bound with SO_REUSEPORT, so each ring can own one and let the
+// kernel shard incoming connections between them
+inline int reuseport_listener(uint16_t port, int backlog = SOMAXCONN, in_addr_t address = INADDR_ANY) {
+    int sockfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0) | PanicOnErr("socket creation", true);
+    int on = 1;
+    setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) | PanicOnErr("SO_REUSEADDR", true);
+    setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) | PanicOnErr("SO_REUSEPORT", true);
+
+    if (sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr = {htonl(address)},
+        .sin_zero = {0}
+    }; bind(sockfd, reinterpret_cast<sockaddr*>(&addr), sizeof(sockaddr_in))) Panic("bind", errno);
+
+    if (listen(sockfd, backlog)) Panic("listen", errno);
+    return sockfd;
+}
+
+// Thread-per-core runtime: one IOService per worker thread, each thread pinned to its own cpu.
+// Rings share nothing; IOService::current() gives a worker its own ring.
+class Runtime {
+public:
+    explicit Runtime(unsigned threads = std::thread::hardware_concurrency(), int entries = 64)
+        : entries_(entries) {
+        unsigned ncpu = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned i = 0; i < threads; ++i) {
+            cpus_.push_back(int(i % ncpu));
+        }
+    }
+
+    // pin worker i to cpus[i]; a negative cpu leaves the worker unpinned
+    explicit Runtime(std::vector<int> cpus, int entries = 64)
+        : entries_(entries), cpus_(std::move(cpus)) {}
+
+    ~Runtime() {
+        stop();
+        join_threads();
+    }
+
+    Runtime(const Runtime&) = delete;
+    Runtime& operator=(const Runtime&) = delete;
+
+    // Run every ring in SQPOLL mode, call before start(). Each run of `group` consecutive workers
+    // (0: all of them) shares one kernel poller thread, pinned to `cpu` if non-negative, which
+    // sleeps after `idle_ms` without work.
+    void use_sqpoll(unsigned idle_ms = 1000, int cpu = -1, unsigned group = 0) noexcept {
+        sqpoll_ = true;
+        sqpoll_idle_ = idle_ms;
+        sqpoll_cpu_ = cpu;
+        sqpoll_group_ = group;
+    }
+
+    // Run `fn(service, index)` on every worker, it must return a Task<>.
+    // Returns once every ring is up, so service(i) is usable by then; workers only enter `fn`
+    // after all of their peers exist.
+    template <typename Fn>
+    void start(Fn fn) {
+        unsigned n = size();
+        services_.assign(n, nullptr);
+        errors_.assign(n, nullptr);
+        for (unsigned i = 0; i < n; ++i) {
+            stop_fds_.push_back(eventfd(0, EFD_CLOEXEC) | PanicOnErr("eventfd", true));
+        }
+
+        // the first ring of each sqpoll group owns the poller, the others attach to it
+        unsigned group = sqpoll_group_ ? std::min(sqpoll_group_, n) : n;
+        unsigned groups = sqpoll_ ? (n + group - 1) / group : 0;
+        std::vector<int> poller_fds(groups, -1);
+        std::latch pollers(groups);
+
+        std::latch started(n + 1);
+        exited_ = std::make_unique<std::latch>(n);
+        for (unsigned i = 0; i < n; ++i) {
+            threads_.emplace_back([this, i, fn, group, &poller_fds, &pollers, &started]() {
+                if (cpus_[i] >= 0) {
+                    cpu_set_t set;
+                    CPU_ZERO(&set);
+                    CPU_SET(cpus_[i], &set);
+                    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+                }
+
+                uint32_t flags = 0, wq_fd = 0;
+                bool owns_poller = sqpoll_ && i % group == 0;
+                if (sqpoll_) {
+                    flags = IORING_SETUP_SQPOLL;
+                    if (!owns_poller) {
+                        pollers.wait();
+                        wq_fd = uint32_t(poller_fds[i / group]);
+                    }
+                }
+
+                IOService service(entries_, flags, wq_fd, sqpoll_idle_, sqpoll_cpu_);
+                if (owns_poller) {
+                    poller_fds[i / group] = service.get_handle().ring_fd;
+                    pollers.count_down();
+                }
+                services_[i] = &service;
+                started.arrive_and_wait();
+
+                try {
+                    auto main = finish_with(fn(service, i), stop_fds_[i]);
+                    service.run(wait_stop(service, stop_fds_[i]));
+                    if (main.done()) {
+                        main.get_result();
+                    }
+                } catch (...) {
+                    errors_[i] = std::current_exception();
+                }
+                running_.fetch_sub(1, std::memory_order_release);
+                // peers may still hold a pointer to this ring
+                exited_->arrive_and_wait();
+                services_[i] = nullptr;
+            });
+        }
+        running_.store(n, std::memory_order_release);
+        started.arrive_and_wait();
+    }
+
+    // ask every worker to leave its run loop; callable from any thread
+    void stop() noexcept {
+        for (int fd : stop_fds_) {
+            eventfd_write(fd, 1);
+        }
+    }
+
+    // wait for all workers, rethrowing the first exception one of them ended with
+    void join() {
+        join_threads();
+        for (auto& e : std::exchange(errors_, {})) {
+            if (e) std::rethrow_exception(e);
+        }
+    }
+
+    [[nodiscard]]
+    unsigned size() const noexcept {
+        return unsigned(cpus_.size());
+    }
+
+    // ring of worker `index`, valid between start() and join()
+    [[nodiscard]]
+    IOService& service(unsigned index) noexcept {
+        return *services_[index];
+    }
+
+    // number of workers that haven't left their run loop yet
+    [[nodiscard]]
+    unsigned running() const noexcept {
+        return running_.load(std::memory_order_acquire);
+    }
+
+private:
+    void join_threads() noexcept {
+        for (auto& t : threads_) {
+            if (t.joinable()) t.join();
+        }
+        threads_.clear();
+        for (int fd : std::exchange(stop_fds_, {})) {
+            ::close(fd);
+        }
+    }
+
+    static Task<> wait_stop(IOService& service, int fd) {
+        eventfd_t value;
+        co_await service.read(fd, &value, sizeof(value), 0);
+    }
+
+    // a worker whose task is over stops by itself
+    static Task<> finish_with(Task<> main, int fd) {
+        OnScopeExit notify([=]() { eventfd_write(fd, 1); });
+        co_await main;
+    }
+
+    int entries_;
+    bool sqpoll_ = false;
+    unsigned sqpoll_idle_ = 0;
+    int sqpoll_cpu_ = -1;
+    unsigned sqpoll_group_ = 0;
+    std::vector<int> cpus_;
+    std::vector<std::thread> threads_;
+    std::vector<IOService*> services_;
+    std::vector<int> stop_fds_;
+    std::vector<std::exception_ptr> errors_;
+    std::atomic<unsigned> running_{0};
+    std::unique_ptr<std::latch> exited_;
+};
+
+}
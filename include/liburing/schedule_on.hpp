@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cerrno>
+#include <coroutine>
+#include <cstdint>
+#include <liburing.h>
+
+#include "io_service.hpp"
+#include "sqe_awaitable.hpp"
+#include "utils.hpp"
+
+namespace coro {
+
+// Moves the awaiting coroutine onto the thread running `target`.
+// The current ring posts an IORING_OP_MSG_RING cqe into the target ring, whose run() loop resumes
+// the coroutine like any other completion: no locks, no eventfds.
+// await_resume() yields 0, or a negative errno if the target ring refused the message, in which
+// case the coroutine carries on where it was.
+class ScheduleOnAwaiter {
+public:
+    explicit ScheduleOnAwaiter(IOService& target) noexcept
+        : target_(&target) {}
+
+    ScheduleOnAwaiter(const ScheduleOnAwaiter&) = delete;
+    ScheduleOnAwaiter& operator=(const ScheduleOnAwaiter&) = delete;
+
+    static constexpr bool migrates = true;
+
+    bool await_ready() const noexcept {
+        return IOService::current() == target_;
+    }
+
+    void await_suspend(std::coroutine_handle<> handle) noexcept {
+        handle_ = handle;
+        post();
+    }
+
+    int await_resume() const noexcept {
+        return result_;
+    }
+
+private:
+    // completion posted into the target ring, the coroutine wakes up there
+    struct Arrived final : public Resolver {
+        explicit Arrived(ScheduleOnAwaiter* self) noexcept : self(self) {}
+        ScheduleOnAwaiter* self;
+
+        void resolve(int, uint32_t) noexcept override {
+            self->handle_.resume();
+        }
+    };
+
+    // completion of the msg_ring sqe itself; only posted on failure (IOSQE_CQE_SKIP_SUCCESS),
+    // otherwise the coroutine may be long gone on the other thread by then
+    struct Failed final : public Resolver {
+        explicit Failed(ScheduleOnAwaiter* self) noexcept : self(self) {}
+        ScheduleOnAwaiter* self;
+
+        void resolve(int result, uint32_t) noexcept override {
+            if (result == -EOVERFLOW) {
+                // target cq is full, try again once our ring loops
+                self->post();
+            } else {
+                self->result_ = result;
+                self->handle_.resume();
+            }
+        }
+    };
+
+    void post() noexcept {
+        auto* source = IOService::current();
+        if (!source) [[unlikely]] {
+            Panic("schedule_on: no IOService on this thread", EINVAL);
+        }
+        auto* sqe = source->io_uring_get_sqe_safe();
+        io_uring_prep_msg_ring(sqe, target_->get_handle().ring_fd, 0,
+            reinterpret_cast<uint64_t>(static_cast<Resolver*>(&arrived_)), 0);
+        io_uring_sqe_set_data(sqe, static_cast<Resolver*>(&failed_));
+        io_uring_sqe_set_flags(sqe, IOSQE_CQE_SKIP_SUCCESS);
+        source->sqe_armed();
+    }
+
+    IOService* target_;
+    std::coroutine_handle<> handle_;
+    int result_ = 0;
+    Arrived arrived_{this};
+    Failed failed_{this};
+};
+
+// co_await schedule_on(service) continues the coroutine on the thread driving `service`
+[[nodiscard]]
+inline ScheduleOnAwaiter schedule_on(IOService& target) noexcept {
+    return ScheduleOnAwaiter(target);
+}
+
+}
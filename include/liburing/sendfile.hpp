@@ -0,0 +1,220 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "io_service.hpp"
+#include "utils.hpp"
+
+namespace coro {
+
+class PipeLease;
+
+// Pipes of one ring reused across sendfile() calls, grown to `pipe_size` each so one splice
+// moves as much as possible. Creating a pipe and resizing it costs three syscalls, which a
+// stream of small static files would otherwise pay per request.
+class PipePool {
+public:
+    // pipes above /proc/sys/fs/pipe-max-size need CAP_SYS_RESOURCE, they stay smaller otherwise
+    explicit PipePool(IOService& service, size_t pipe_size = 1 << 20, unsigned max_idle = 16) noexcept
+        : service_(&service), pipe_size_(pipe_size), max_idle_(max_idle) {}
+
+    ~PipePool() {
+        for (auto& pipe : idle_) {
+            ::close(pipe.fds[0]);
+            ::close(pipe.fds[1]);
+        }
+    }
+
+    PipePool(const PipePool&) = delete;
+    PipePool& operator=(const PipePool&) = delete;
+
+    // an idle pipe, or a new one
+    [[nodiscard]]
+    inline PipeLease lease();
+
+    [[nodiscard]]
+    IOService& service() const noexcept {
+        return *service_;
+    }
+
+    [[nodiscard]]
+    size_t idle() const noexcept {
+        return idle_.size();
+    }
+
+private:
+    friend class PipeLease;
+
+    struct Pipe {
+        int fds[2];
+        size_t size;
+    };
+
+    void give_back(Pipe pipe) noexcept {
+        if (idle_.size() < max_idle_) {
+            idle_.push_back(pipe);
+        } else {
+            ::close(pipe.fds[0]);
+            ::close(pipe.fds[1]);
+        }
+    }
+
+    IOService* service_;
+    size_t pipe_size_;
+    unsigned max_idle_;
+    std::vector<Pipe> idle_;
+};
+
+// A pipe of a PipePool, returned to the pool on destruction unless marked dirty
+class PipeLease {
+public:
+    PipeLease(PipeLease&& other) noexcept
+        : pool_(std::exchange(other.pool_, nullptr)), pipe_(other.pipe_), dirty_(other.dirty_) {}
+
+    PipeLease& operator=(PipeLease&&) = delete;
+    PipeLease(const PipeLease&) = delete;
+    PipeLease& operator=(const PipeLease&) = delete;
+
+    ~PipeLease() {
+        if (!pool_) {
+            return;
+        }
+        if (dirty_) {
+            ::close(pipe_.fds[0]);
+            ::close(pipe_.fds[1]);
+        } else {
+            pool_->give_back(pipe_);
+        }
+    }
+
+    [[nodiscard]]
+    int read_fd() const noexcept {
+        return pipe_.fds[0];
+    }
+
+    [[nodiscard]]
+    int write_fd() const noexcept {
+        return pipe_.fds[1];
+    }
+
+    // capacity in bytes
+    [[nodiscard]]
+    size_t size() const noexcept {
+        return pipe_.size;
+    }
+
+    // the pipe may still hold data, close it instead of pooling it
+    void set_dirty() noexcept {
+        dirty_ = true;
+    }
+
+private:
+    friend class PipePool;
+
+    PipeLease(PipePool* pool, PipePool::Pipe pipe) noexcept : pool_(pool), pipe_(pipe) {}
+
+    PipePool* pool_;
+    PipePool::Pipe pipe_;
+    bool dirty_ = false;
+};
+
+inline PipeLease PipePool::lease() {
+    if (!idle_.empty()) {
+        auto pipe = idle_.back();
+        idle_.pop_back();
+        return PipeLease(this, pipe);
+    }
+
+    Pipe pipe;
+    pipe2(pipe.fds, O_CLOEXEC) | PanicOnErr("pipe2", true);
+    int size = fcntl(pipe.fds[1], F_SETPIPE_SZ, int(pipe_size_));
+    if (size < 0) {
+        size = fcntl(pipe.fds[1], F_GETPIPE_SZ) | PanicOnErr("fcntl", true);
+    }
+    pipe.size = size_t(size);
+    return PipeLease(this, pipe);
+}
+
+namespace detail {
+// sendfile() without splice: through a userspace buffer
+inline Task<int64_t> sendfile_copy(IOService& service, int out_fd, int in_fd, off_t offset, size_t count) {
+    std::unique_ptr<char[]> buffer(new char[std::min<size_t>(count, 128 * 1024)]);
+    size_t chunk = std::min<size_t>(count, 128 * 1024);
+    int64_t sent = 0;
+    while (size_t(sent) < count) {
+        int r = co_await service.read(in_fd, buffer.get(), std::min(chunk, count - size_t(sent)), offset + sent);
+        if (r <= 0) {
+            co_return sent ? sent : r;
+        }
+        for (int done = 0; done < r;) {
+            int w = co_await service.send(out_fd, buffer.get() + done, unsigned(r - done), MSG_NOSIGNAL);
+            if (w < 0) {
+                co_return w;
+            }
+            done += w;
+        }
+        sent += r;
+    }
+    co_return sent;
+}
+}
+
+// Send `count` bytes of `in_fd` from `offset` to the socket `out_fd` without copying them
+// through userspace: each chunk is spliced file -> pipe -> socket by two linked sqes, on a pipe
+// leased from `pipes`. Falls back to read/send where splice isn't available for the file.
+// Yields the bytes sent, fewer at end of file, or a negative errno if nothing was sent.
+inline Task<int64_t> sendfile(PipePool& pipes, int out_fd, int in_fd, off_t offset, size_t count) {
+    auto& service = pipes.service();
+    if (!service.supports(IORING_OP_SPLICE)) {
+        co_return co_await detail::sendfile_copy(service, out_fd, in_fd, offset, count);
+    }
+
+    auto pipe = pipes.lease();
+    int64_t sent = 0;
+    size_t in_pipe = 0;
+    while (size_t(sent) + in_pipe < count || in_pipe) {
+        if (!in_pipe) {
+            unsigned chunk = unsigned(std::min(pipe.size(), count - size_t(sent)));
+            // a short fill fails the link, the drain then sees -ECANCELED and the loop drains
+            // whatever did make it into the pipe
+            service.reserve_sqes(2);
+            DeferredResolver fill;
+            service.splice(in_fd, offset + sent, pipe.write_fd(), -1, chunk, SPLICE_F_MOVE, IOSQE_IO_LINK)
+                .set_deferred(fill);
+            int drained = co_await service.splice(pipe.read_fd(), -1, out_fd, -1, chunk, SPLICE_F_MOVE);
+            int filled = *fill.result_;
+            if (filled <= 0) {
+                if (sent == 0 && (filled == -EINVAL || filled == -EOPNOTSUPP)) {
+                    // this file can't be spliced
+                    co_return co_await detail::sendfile_copy(service, out_fd, in_fd, offset, count);
+                }
+                co_return sent ? sent : filled;
+            }
+            if (drained < 0 && drained != -ECANCELED) {
+                pipe.set_dirty();
+                co_return sent ? sent : drained;
+            }
+            drained = std::max(drained, 0);
+            sent += drained;
+            in_pipe = size_t(filled - drained);
+        } else {
+            int drained = co_await service.splice(pipe.read_fd(), -1, out_fd, -1, unsigned(in_pipe), SPLICE_F_MOVE);
+            if (drained <= 0) {
+                pipe.set_dirty();
+                co_return sent ? sent : (drained ? drained : -EPIPE);
+            }
+            sent += drained;
+            in_pipe -= size_t(drained);
+        }
+    }
+    co_return sent;
+}
+
+}
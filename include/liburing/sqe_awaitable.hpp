@@ -1,23 +1,64 @@
 #pragma once
 
+#include <algorithm>
+#include <cerrno>
 #include <climits>
 #include <liburing/io_uring.h>
 #include <type_traits>
 #include <optional>
 #include <cassert>
 #include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <chrono>
 #include <functional>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
 #include "liburing.h"
 
+#include "task.hpp"
+#ifdef LIBURING_TRACE
+#include "latency.hpp"
+#endif
+
 namespace coro {
+class IOService;
+
+// applies the service's submit policy once an sqe carries its user_data, see io_service.hpp
+inline void on_sqe_armed(IOService& service) noexcept;
+
+// Completion kinds, stored in the low bits of an sqe's user_data so run() can dispatch a cqe
+// with a plain switch; only `generic` goes through a vtable. Every resolver is 8-byte aligned.
+enum class ResolverKind : uint64_t {
+    generic = 0,    // Resolver*, virtual resolve(); multishot and other stateful ops
+    resume = 1,     // ResumeResolver*, store the result and resume the awaiting coroutine
+    deferred = 2,   // DeferredResolver*, store the result
+    callback = 3,   // CallbackSlot*, invoke the callback and recycle the slot
+    zero_copy = 4,  // ZeroCopyResolver*, a send_zc result followed by its notification
+};
+
+inline constexpr uint64_t RESOLVER_KIND_MASK = 7;
+
+[[nodiscard]]
+inline uint64_t tag_user_data(const void* resolver, ResolverKind kind) noexcept {
+    auto data = reinterpret_cast<uint64_t>(resolver);
+    assert(!(data & RESOLVER_KIND_MASK) && "resolver is not 8-byte aligned");
+    return data | uint64_t(kind);
+}
+
 struct Resolver {
-    virtual void resolve(int result) noexcept = 0;
+    // `flags` are the cqe flags, multishot ops need IORING_CQE_F_MORE from them
+    virtual void resolve(int result, uint32_t flags) noexcept = 0;
 };
 
-struct ResumeResolver final : public Resolver {
+struct alignas(8) ResumeResolver {
     friend struct SqeAwaitable;
 
-    void resolve(int result) noexcept override {
+    explicit ResumeResolver(std::coroutine_handle<> handle = {}) noexcept : handle_(handle) {}
+
+    void resolve(int result, uint32_t) noexcept {
         this->result_ = result;
         handle_.resume();
     }
@@ -27,8 +68,8 @@ private:
     int result_{};
 };
 
-struct DeferredResolver final : public Resolver {
-    void resolve(int result) noexcept {
+struct alignas(8) DeferredResolver {
+    void resolve(int result, uint32_t) noexcept {
         this->result_ = result;
     }
 
@@ -41,51 +82,322 @@ struct DeferredResolver final : public Resolver {
     std::optional<int> result_;
 };
 
-struct CallbackResolver final : public Resolver {
-    CallbackResolver(std::function<void(int)>&& cb) : cb_(std::move(cb)) {}
+// Zero-copy sends complete twice: once with the byte count, flagged IORING_CQE_F_MORE if the
+// kernel still holds the buffer, then with IORING_CQE_F_NOTIF once it let go of it. The waiter is
+// resumed after both, so the buffer may be reused as soon as co_await returns.
+struct alignas(8) ZeroCopyResolver {
+    void resolve(int result, uint32_t flags) noexcept {
+        if (flags & IORING_CQE_F_NOTIF) {
+            notified_ = true;
+        } else {
+            result_ = result;
+            completed_ = true;
+            notified_ = !(flags & IORING_CQE_F_MORE);
+        }
+        if (completed_ && notified_) {
+            handle_.resume();
+        }
+    }
+
+    std::coroutine_handle<> handle_;
+    int result_ = 0;
+    bool completed_ = false;
+    bool notified_ = false;
+};
+
+// An op bounded by a deadline is followed by an IORING_OP_LINK_TIMEOUT, and the two complete in
+// either order. The waiter resumes once both are in; the timeout's own result, -ETIME if it
+// fired, tells an expired deadline from any other cancellation of the op.
+struct DeadlineResolver {
+    struct Completion final : Resolver {
+        explicit Completion(DeadlineResolver& owner) noexcept : owner_(owner) {}
+
+        void resolve(int result, uint32_t) noexcept override {
+            result_ = result;
+            if (!--owner_.pending_) {
+                owner_.handle_.resume();
+            }
+        }
+
+        DeadlineResolver& owner_;
+        int result_ = 0;
+    };
+
+    DeadlineResolver() noexcept = default;
+    DeadlineResolver(const DeadlineResolver&) = delete;
+    DeadlineResolver& operator=(const DeadlineResolver&) = delete;
+
+    int result() const noexcept {
+        return op_.result_ == -ECANCELED && timeout_.result_ == -ETIME ? -ETIME : op_.result_;
+    }
+
+    std::coroutine_handle<> handle_;
+    unsigned pending_ = 2;
+    Completion op_{*this};
+    Completion timeout_{*this};
+};
+
+// A completion callback kept in place when small enough, on the heap otherwise.
+// Slots come from the IOService's CallbackPool, so small callbacks cost no allocation.
+struct alignas(8) CallbackSlot {
+    static constexpr size_t INLINE_SIZE = 48;
+
+    template <typename Fn>
+    void emplace(Fn&& fn) {
+        using F = std::decay_t<Fn>;
+        if constexpr (sizeof(F) <= INLINE_SIZE && alignof(F) <= alignof(std::max_align_t)) {
+            new (storage_) F(std::forward<Fn>(fn));
+            invoke_ = [](CallbackSlot& slot, int result) noexcept {
+                auto* f = std::launder(reinterpret_cast<F*>(slot.storage_));
+                (*f)(result);
+                f->~F();
+            };
+        } else {
+            new (storage_) F*(new F(std::forward<Fn>(fn)));
+            invoke_ = [](CallbackSlot& slot, int result) noexcept {
+                auto* f = *std::launder(reinterpret_cast<F**>(slot.storage_));
+                (*f)(result);
+                delete f;
+            };
+        }
+    }
+
+    // run and destroy the callback
+    void resolve(int result, uint32_t) noexcept {
+        invoke_(*this, result);
+    }
+
+private:
+    friend class CallbackPool;
+
+    union {
+        alignas(std::max_align_t) unsigned char storage_[INLINE_SIZE];
+        CallbackSlot* next_;
+    };
+    void (*invoke_)(CallbackSlot&, int) noexcept = nullptr;
+};
+
+// Free list of CallbackSlots, grown a chunk at a time and released with the pool
+class CallbackPool {
+public:
+    CallbackPool() = default;
+    CallbackPool(const CallbackPool&) = delete;
+    CallbackPool& operator=(const CallbackPool&) = delete;
+
+    [[nodiscard]]
+    CallbackSlot* acquire() {
+        if (!free_) [[unlikely]] {
+            auto& chunk = chunks_.emplace_back(std::make_unique<CallbackSlot[]>(CHUNK_SIZE));
+            for (size_t i = 0; i < CHUNK_SIZE; ++i) {
+                chunk[i].next_ = free_;
+                free_ = &chunk[i];
+            }
+        }
+        return std::exchange(free_, free_->next_);
+    }
 
-    void resolve(int result) noexcept {
-        cb_(result);
-        delete this;
+    void release(CallbackSlot* slot) noexcept {
+        slot->next_ = free_;
+        free_ = slot;
     }
+
 private:
-    std::function<void(int)> cb_;
+    static constexpr size_t CHUNK_SIZE = 64;
+
+    std::vector<std::unique_ptr<CallbackSlot[]>> chunks_;
+    CallbackSlot* free_ = nullptr;
 };
 
+// the service's pool for SqeAwaitable::set_callback(), see io_service.hpp
+inline CallbackPool& callback_pool(IOService& service) noexcept;
+
+// link an IORING_OP_LINK_TIMEOUT tagged `timeout_data` for `deadline` behind `sqe`, which may
+// move, keeping the timespec in `ts`; false if `sqe` can't be bounded and is failed instead,
+// see io_service.hpp
+inline bool link_deadline(IOService& service, io_uring_sqe*& sqe, __kernel_timespec& ts,
+    std::chrono::steady_clock::time_point deadline, uint64_t timeout_data) noexcept;
+
+// ask the kernel to cancel the op submitted with `user_data`, see io_service.hpp
+inline void cancel_user_data(IOService& service, uint64_t user_data) noexcept;
+
 struct SqeAwaitable {
-    SqeAwaitable(io_uring_sqe* sqe) noexcept : sqe_(sqe) {}
+    struct AwaitSqe {
+        ResumeResolver resolver{};
+        DeadlineResolver deadline_resolver{};
+        IOService* service;
+        io_uring_sqe* sqe;
+        std::chrono::steady_clock::time_point deadline;
+        __kernel_timespec ts{};
+        bool bounded = false;
+        bool rejected = false;
+        bool cancelled = false;
+
+        AwaitSqe(IOService* service, io_uring_sqe* sqe, std::chrono::steady_clock::time_point deadline)
+            : service(service), sqe(sqe), deadline(deadline) {}
+        
+        constexpr bool await_ready() const noexcept { 
+            return false;
+        }
+
+        template <typename P>
+        void await_suspend(std::coroutine_handle<P> handle) noexcept {
+            resolver.handle_ = handle;
+            if constexpr (std::is_base_of_v<TaskContext, P>) {
+                // scoped deadline of the awaiting task
+                deadline = std::min(deadline, handle.promise().deadline);
+            }
+            if (deadline != std::chrono::steady_clock::time_point::max()) {
+                deadline_resolver.handle_ = handle;
+                bounded = link_deadline(*service, sqe, ts, deadline,
+                    tag_user_data(&deadline_resolver.timeout_, ResolverKind::generic));
+                rejected = !bounded;
+            }
+            io_uring_sqe_set_data64(sqe, user_data());
+            on_sqe_armed(*service);
+            if (cancelled) [[unlikely]] {
+                cancel();
+            }
+        }
+
+        // see TaskContext::cancel(); the op completes with -ECANCELED unless it already finished
+        void cancel() noexcept {
+            cancelled = true;
+            if (resolver.handle_) {
+                cancel_user_data(*service, user_data());
+            }
+        }
+
+        uint64_t user_data() const noexcept {
+            return bounded ? tag_user_data(&deadline_resolver.op_, ResolverKind::generic)
+                : tag_user_data(&resolver, ResolverKind::resume);
+        }
+
+#ifdef LIBURING_TRACE
+        trace::Await trace() const noexcept {
+            return {opcode_name(sqe->opcode), "fd", sqe->fd};
+        }
+#endif
+
+        int await_resume() const noexcept {
+            if (bounded) {
+                return deadline_resolver.result();
+            }
+            // the deadline couldn't be linked to the op, which never ran
+            return rejected ? -EINVAL : resolver.result_;
+        }
+    };
+
+    SqeAwaitable(IOService& service, io_uring_sqe* sqe) noexcept : service_(&service), sqe_(sqe) {}
+    SqeAwaitable(SqeAwaitable&& other) noexcept
+        : service_(other.service_), sqe_(std::exchange(other.sqe_, nullptr)), deadline_(other.deadline_) {}
+    SqeAwaitable(const SqeAwaitable&) = delete;
+    SqeAwaitable& operator=(const SqeAwaitable&) = delete;
+
+    // Dropped without being awaited: the op still runs, its completion is ignored. The sqe may
+    // wait in the backlog, so it gets its user_data now rather than never.
+    ~SqeAwaitable() {
+        if (sqe_) {
+            io_uring_sqe_set_data(sqe_, nullptr);
+            on_sqe_armed(*service_);
+        }
+    }
+
     void set_deferred(DeferredResolver& resolver) {
-        io_uring_sqe_set_data(sqe_, &resolver);
+        io_uring_sqe_set_data64(std::exchange(sqe_, nullptr), tag_user_data(&resolver, ResolverKind::deferred));
+        on_sqe_armed(*service_);
     }
 
-    void set_callback(std::function<void(int)> cb) {
-        io_uring_sqe_set_data(sqe_, new CallbackResolver(std::move(cb)));
+    // bound the op to `deadline` when awaited, see with_deadline()
+    void set_deadline(std::chrono::steady_clock::time_point deadline) noexcept {
+        deadline_ = deadline;
+    }
+
+    // `cb(int result)` runs once the op completes; deadlines only apply to awaited ops
+    template <typename Fn>
+    void set_callback(Fn&& cb) {
+        auto* slot = callback_pool(*service_).acquire();
+        slot->emplace(std::forward<Fn>(cb));
+        io_uring_sqe_set_data64(std::exchange(sqe_, nullptr), tag_user_data(slot, ResolverKind::callback));
+        on_sqe_armed(*service_);
     }
     
     auto operator co_await() {
-        struct AwaitSqe {
-            ResumeResolver resolver{};
-            io_uring_sqe* sqe;
-
-            AwaitSqe(io_uring_sqe* sqe) : sqe(sqe) {}
-            
-            constexpr bool await_ready() const noexcept { 
-                return false;
-            }
+        return AwaitSqe(service_, std::exchange(sqe_, nullptr), deadline_);
+    }
+private:
+    IOService* service_;
+    io_uring_sqe* sqe_;
+    std::chrono::steady_clock::time_point deadline_ = std::chrono::steady_clock::time_point::max();
+};
 
-            void await_suspend(std::coroutine_handle<> handle) noexcept {
-                resolver.handle_ = handle;
-                io_uring_sqe_set_data(sqe, &resolver);
-            }
+// co_await service.send_zc(...) / sendmsg_zc(...): yields the bytes sent, or a negative errno,
+// once the kernel no longer references the buffer
+class ZeroCopyAwaitable {
+public:
+    ZeroCopyAwaitable(IOService& service, io_uring_sqe* sqe) noexcept : service_(&service), sqe_(sqe) {}
 
-            constexpr int await_resume() const noexcept {
-                return resolver.result_;
-            }
-        };
+    ZeroCopyAwaitable(const ZeroCopyAwaitable&) = delete;
+    ZeroCopyAwaitable& operator=(const ZeroCopyAwaitable&) = delete;
+
+    // see ~SqeAwaitable()
+    ~ZeroCopyAwaitable() {
+        if (!resolver_.handle_) {
+            io_uring_sqe_set_data(sqe_, nullptr);
+            on_sqe_armed(*service_);
+        }
+    }
+
+    constexpr bool await_ready() const noexcept {
+        return false;
+    }
 
-        return AwaitSqe(sqe_);
+    void await_suspend(std::coroutine_handle<> handle) noexcept {
+        resolver_.handle_ = handle;
+        io_uring_sqe_set_data64(sqe_, tag_user_data(&resolver_, ResolverKind::zero_copy));
+        on_sqe_armed(*service_);
+        if (cancelled_) [[unlikely]] {
+            cancel();
+        }
     }
+
+    // see TaskContext::cancel(); the notification still arrives before the waiter resumes
+    void cancel() noexcept {
+        cancelled_ = true;
+        if (resolver_.handle_) {
+            cancel_user_data(*service_, tag_user_data(&resolver_, ResolverKind::zero_copy));
+        }
+    }
+
+    int await_resume() const noexcept {
+        return resolver_.result_;
+    }
+
+#ifdef LIBURING_TRACE
+    trace::Await trace() const noexcept {
+        return {opcode_name(sqe_->opcode), "fd", sqe_->fd};
+    }
+#endif
+
 private:
+    IOService* service_;
     io_uring_sqe* sqe_;
+    ZeroCopyResolver resolver_;
+    bool cancelled_ = false;
 };
+
+// bound `op` to `deadline`: the kernel cancels it once the deadline passes, and co_await yields
+// -ETIME instead of its result. An op linked to the ops prepared around it can only be bounded
+// if it ends its chain and was prepared last; otherwise it doesn't run and yields -EINVAL.
+[[nodiscard]]
+inline SqeAwaitable with_deadline(SqeAwaitable op, std::chrono::steady_clock::time_point deadline) noexcept {
+    op.set_deadline(deadline);
+    return op;
+}
+
+template <typename Rep, typename Period>
+[[nodiscard]]
+inline SqeAwaitable with_deadline(SqeAwaitable op, std::chrono::duration<Rep, Period> duration) noexcept {
+    return with_deadline(std::move(op), std::chrono::steady_clock::now()
+        + std::chrono::duration_cast<std::chrono::steady_clock::duration>(duration));
+}
 }
\ No newline at end of file
@@ -1,19 +1,262 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <exception>
+#include <memory>
+#include <optional>
+#include <stop_token>
+#include <thread>
 #include <type_traits>
 #include <variant>
 #include <coroutine>
 #include <cassert>
 #include <utility>
 
+#include "frame_allocator.hpp"
+#ifdef LIBURING_TRACE
+#include "trace.hpp"
+#endif
+
 namespace coro
 {
     template <typename T, bool nothrow>
     struct Task;
 
+    // Tasks awaited together by one coroutine, see when_all/when_any: each finishing task counts
+    // down, the one reaching zero resumes the waiter. The waiter holds one count itself while it
+    // hooks the tasks, so none can resume it before it is done with that.
+    // As long as its tasks stay on their ring the counter is bumped with plain loads and stores.
+    // Once one of them changes threads (schedule_on(), WorkStealingPool) children of the waiter
+    // can finish on different rings at once, and this counter switches to atomic
+    // read-modify-writes; counters of other waiters are not affected.
+    struct JoinCounter {
+        // wait for `n` arrivals; with `first_only` only the first task to finish arrives, see
+        // task_done()
+        void reset(size_t n, bool first_only = false) noexcept {
+            remaining_.store(n, std::memory_order_relaxed);
+            first_only_ = first_only;
+            claimed_.store(false, std::memory_order_relaxed);
+        }
+
+        void add() noexcept {
+            if (!cross_thread_.load(std::memory_order_acquire)) [[likely]] {
+                remaining_.store(remaining_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            } else {
+                remaining_.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        // whether this was the last arrival
+        bool arrive() noexcept {
+            if (!cross_thread_.load(std::memory_order_acquire)) [[likely]] {
+                size_t n = remaining_.load(std::memory_order_relaxed) - 1;
+                remaining_.store(n, std::memory_order_relaxed);
+                return n == 0;
+            }
+            return remaining_.fetch_sub(1, std::memory_order_acq_rel) == 1;
+        }
+
+        // a task hooked on the counter finished; whether it has to resume the waiter
+        bool task_done() noexcept {
+            if (first_only_) {
+                if (!cross_thread_.load(std::memory_order_acquire)) [[likely]] {
+                    if (claimed_.load(std::memory_order_relaxed)) {
+                        return false;
+                    }
+                    claimed_.store(true, std::memory_order_relaxed);
+                } else if (claimed_.exchange(true, std::memory_order_acq_rel)) {
+                    return false;
+                }
+            }
+            return arrive();
+        }
+
+        // called before a task counted here is handed to another thread
+        void enable_cross_thread() noexcept {
+            cross_thread_.store(true, std::memory_order_release);
+        }
+
+    private:
+        std::atomic<size_t> remaining_{0};
+        std::atomic<bool> cross_thread_{false};
+        std::atomic<bool> claimed_{false};
+        bool first_only_ = false;
+    };
+
+    // State a task hands down to the tasks it starts: the deadline bounding every op it awaits
+    // (see DeadlineScope), its stop token and whether it was cancelled. current() is the task
+    // running on this thread; it is pushed whenever a task starts or resumes and popped whenever
+    // it suspends.
+    struct TaskContext {
+        using time_point = std::chrono::steady_clock::time_point;
+
+        time_point deadline = time_point::max();
+        std::stop_token stop_token;     // see StopScope
+#ifdef LIBURING_TRACE
+        uint64_t trace_id = trace::next_id();
+#endif
+
+        [[nodiscard]]
+        static TaskContext* current() noexcept {
+            return current_;
+        }
+
+        // whether the task was cancelled or a stop was requested on its token
+        [[nodiscard]]
+        bool stop_requested() const noexcept {
+            return cancelled_ || stop_token.stop_requested();
+        }
+
+        // Cancel whatever the task awaits, if the awaiter has a cancel(): ring ops are cancelled
+        // with IORING_OP_ASYNC_CANCEL, sleeps and streams wake up with -ECANCELED, awaited tasks
+        // are cancelled in turn. Every later await of the task is cancelled as it suspends.
+        // Must be called on the thread running the task.
+        void cancel() noexcept {
+            cancelled_ = true;
+            if (pending_.fn) {
+                pending_.fn(pending_.self);
+            }
+        }
+
+    protected:
+        template <typename A>
+        friend struct ContextAwaiter;
+        template <typename T, bool nothrow>
+        friend struct BaseTaskPromise;
+
+        // cancel() of the awaiter the task is suspended on
+        struct CancelHook {
+            void (*fn)(void*) noexcept = nullptr;
+            void* self = nullptr;
+        };
+
+        void inherit() noexcept {
+            if (current_) {
+                deadline = current_->deadline;
+                stop_token = current_->stop_token;
+                cancelled_ = current_->cancelled_;
+            }
+        }
+
+        void enter() noexcept {
+            resumer_ = std::exchange(current_, this);
+        }
+
+        void leave() noexcept {
+            current_ = resumer_;
+        }
+
+        // Called right before an awaiter hands the task to another thread. From then on the task
+        // is joined through hook_ and the counter it is joined on is atomic, see
+        // BaseTaskPromise::hook(). The tasks waiting on it may be resumed on that thread too, so
+        // they are marked alike. Only the first migration has to announce it: until then a task
+        // runs on the thread of whoever joins it.
+        void migrating() noexcept {
+            for (auto* ctx = this; ctx && !ctx->migrated_.load(std::memory_order_relaxed); ctx = ctx->joiner_) {
+                ctx->migrated_.store(true, std::memory_order_relaxed);
+                if (ctx->join_) {
+                    ctx->join_->enable_cross_thread();
+                }
+            }
+        }
+
+        // states of hook_
+        enum : uint8_t { UNHOOKED, HOOKED, DETACHED, FINISHING, FINISHED };
+
+        TaskContext* resumer_ = nullptr;
+        CancelHook pending_;
+        JoinCounter* join_ = nullptr;
+        TaskContext* joiner_ = nullptr;     // the task waiting on this one, if any
+        std::atomic<bool> migrated_{false};
+        std::atomic<uint8_t> hook_{UNHOOKED};
+        bool cancelled_ = false;
+        inline static thread_local TaskContext* current_ = nullptr;
+    };
+
+    template <typename A>
+    decltype(auto) get_awaiter(A&& awaitable) {
+        if constexpr (requires { static_cast<A&&>(awaitable).operator co_await(); }) {
+            return static_cast<A&&>(awaitable).operator co_await();
+        } else if constexpr (requires { operator co_await(static_cast<A&&>(awaitable)); }) {
+            return operator co_await(static_cast<A&&>(awaitable));
+        } else {
+            return static_cast<A&&>(awaitable);
+        }
+    }
+
+    // Wraps every co_await of a task to keep TaskContext::current() up to date. The context is
+    // popped before the inner await_suspend(), which may hand the coroutine to another thread.
+    // Awaiters with a cancel() are registered for TaskContext::cancel() while suspended; cancel()
+    // may come before their await_suspend() if the task is cancelled already. Awaiters resuming
+    // the coroutine on another thread declare `static constexpr bool migrates = true`, see
+    // TaskContext::migrating().
+    template <typename A>
+    struct ContextAwaiter {
+        using awaiter_t = decltype(get_awaiter(std::declval<A>()));
+        static constexpr bool cancellable = requires(awaiter_t& a) { a.cancel(); };
+        static constexpr bool migrates = requires { requires std::remove_reference_t<awaiter_t>::migrates; };
+
+        ContextAwaiter(TaskContext* ctx, A&& awaitable)
+            : ctx_(ctx), awaiter_(get_awaiter(static_cast<A&&>(awaitable))) {}
+
+        bool await_ready() {
+            return awaiter_.await_ready();
+        }
+
+        template <typename P>
+        decltype(auto) await_suspend(std::coroutine_handle<P> handle) {
+            ctx_->leave();
+            suspended_ = true;
+#ifdef LIBURING_TRACE
+            trace::Await await;
+            if constexpr (requires(const awaiter_t& a) { { a.trace() } -> std::convertible_to<trace::Await>; }) {
+                await = awaiter_.trace();
+            }
+            trace_name_ = await.name;
+            trace::await_begin(ctx_->trace_id, await);
+#endif
+            if constexpr (cancellable) {
+                ctx_->pending_ = {&cancel_awaiter, std::addressof(awaiter_)};
+                if (ctx_->stop_requested()) [[unlikely]] {
+                    awaiter_.cancel();
+                }
+            }
+            if constexpr (migrates) {
+                ctx_->migrating();
+            }
+            return awaiter_.await_suspend(handle);
+        }
+
+        decltype(auto) await_resume() {
+            if (suspended_) {
+                ctx_->enter();
+#ifdef LIBURING_TRACE
+                trace::await_end(ctx_->trace_id, trace_name_);
+#endif
+                if constexpr (cancellable) {
+                    ctx_->pending_ = {};
+                }
+            }
+            return awaiter_.await_resume();
+        }
+
+    private:
+        static void cancel_awaiter(void* awaiter) noexcept {
+            static_cast<std::remove_reference_t<awaiter_t>*>(awaiter)->cancel();
+        }
+
+        TaskContext* ctx_;
+        awaiter_t awaiter_;
+        bool suspended_ = false;
+#ifdef LIBURING_TRACE
+        const char* trace_name_ = nullptr;
+#endif
+    };
+
     template <typename T, bool nothrow>
-    struct BaseTaskPromise {
+    struct BaseTaskPromise : public TaskContext {
         std::suspend_never initial_suspend() {
             return {};
         }
@@ -24,12 +267,22 @@ namespace coro
 
                 Awaiter(BaseTaskPromise* me) : me_(me) {}
                 std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) const noexcept {
+                    me_->leave();
+#ifdef LIBURING_TRACE
+                    trace::task_done(me_->trace_id);
+#endif
+                    if (me_->migrated_.load(std::memory_order_relaxed)) [[unlikely]] {
+                        return me_->finish_migrated();
+                    }
                     if (me_->result_.index() == 3) [[unlikely]] {
                         if (me_->waiter_) {
                             me_->waiter_.destroy();
                         }
                         std::coroutine_handle<BaseTaskPromise>::from_promise(*me_).destroy();
                     } else if (me_->waiter_) {
+                        if (me_->join_ && !me_->join_->task_done()) {
+                            return std::noop_coroutine();
+                        }
                         return me_->waiter_;
                     }
                     return std::noop_coroutine();
@@ -41,6 +294,22 @@ namespace coro
 
         Task<T, nothrow> get_return_object();
 
+        template <typename A>
+        ContextAwaiter<A> await_transform(A&& awaitable) {
+            return ContextAwaiter<A>(this, static_cast<A&&>(awaitable));
+        }
+
+#ifndef LIBURING_NO_FRAME_POOL
+        // frames come from the per-thread pool, see FrameAllocator
+        static void* operator new(size_t size) {
+            return FrameAllocator::allocate(size);
+        }
+
+        static void operator delete(void* p, size_t size) noexcept {
+            FrameAllocator::deallocate(p, size);
+        }
+#endif
+
         void unhandled_exception() {
             if constexpr (!nothrow) {
                 if (result_.index() == 3) [[unlikely]] {
@@ -55,7 +324,119 @@ namespace coro
 
     protected:
         friend class Task<T, nothrow>;
-        BaseTaskPromise() = default;
+        BaseTaskPromise() noexcept {
+            // the task runs right away, inheriting from the one starting it
+#ifdef LIBURING_TRACE
+            trace::task_created(trace_id, current_ ? current_->trace_id : 0);
+#endif
+            inherit();
+            enter();
+        }
+
+        // Resume `waiter` once done, after counting down `join` if given. False if the task is
+        // done already; the waiter is not resumed then. Tasks that migrated may finish on another
+        // thread meanwhile, so they hand the waiter over through hook_: whichever of hook() and
+        // finish_migrated() comes second sees the other's state.
+        bool hook(JoinCounter* join, std::coroutine_handle<> waiter, TaskContext* joiner) noexcept {
+            join_ = join;
+            waiter_ = waiter;
+            joiner_ = joiner;
+            if (!migrated_.load(std::memory_order_relaxed)) [[likely]] {
+                hook_.store(HOOKED, std::memory_order_relaxed);
+                return true;
+            }
+            if (joiner) {
+                joiner->migrating();
+            }
+            if (join) {
+                join->enable_cross_thread();
+            }
+            uint8_t state = hook_.load(std::memory_order_acquire);
+            do {
+                state = settled(state);
+                if (state == FINISHED) {
+                    return false;
+                }
+            } while (!hook_.compare_exchange_weak(state, HOOKED, std::memory_order_acq_rel,
+                                                  std::memory_order_acquire));
+            return true;
+        }
+
+        // Forget the waiter again. Returns once a migrated task finishing meanwhile is done with
+        // it, the waiter may go away right after.
+        void unhook() noexcept {
+            if (!migrated_.load(std::memory_order_relaxed)) [[likely]] {
+                join_ = nullptr;
+                waiter_ = {};
+                joiner_ = nullptr;
+                hook_.store(UNHOOKED, std::memory_order_relaxed);
+                return;
+            }
+            uint8_t state = HOOKED;
+            if (!hook_.compare_exchange_strong(state, UNHOOKED, std::memory_order_acq_rel)) {
+                settled(state);
+            }
+        }
+
+        bool finished() const noexcept {
+            if (!migrated_.load(std::memory_order_relaxed)) [[likely]] {
+                return std::coroutine_handle<const BaseTaskPromise>::from_promise(*this).done();
+            }
+            return hook_.load(std::memory_order_acquire) == FINISHED;
+        }
+
+        // Let the task destroy itself once done; true if it is done already and the caller has
+        // to destroy it.
+        bool detach() noexcept {
+            if (!migrated_.load(std::memory_order_relaxed)) [[likely]] {
+                if (finished()) {
+                    return true;
+                }
+                result_.template emplace<3>(std::monostate{});
+                return false;
+            }
+            uint8_t state = hook_.load(std::memory_order_acquire);
+            do {
+                state = settled(state);
+                if (state == FINISHED) {
+                    return true;
+                }
+            } while (!hook_.compare_exchange_weak(state, DETACHED, std::memory_order_acq_rel,
+                                                  std::memory_order_acquire));
+            return false;
+        }
+
+        // `state` once a finish_migrated() running on another thread is done with the waiter
+        uint8_t settled(uint8_t state) const noexcept {
+            while (state == FINISHING) {
+                std::this_thread::yield();
+                state = hook_.load(std::memory_order_acquire);
+            }
+            return state;
+        }
+
+        // final_suspend() of a task that migrated. The frame may be destroyed as soon as hook_
+        // reads FINISHED, so nothing of it is touched after that store.
+        std::coroutine_handle<> finish_migrated() noexcept {
+            uint8_t state = hook_.exchange(FINISHING, std::memory_order_acq_rel);
+            if (state == DETACHED || result_.index() == 3) [[unlikely]] {
+                if (state == HOOKED) {
+                    waiter_.destroy();
+                }
+                std::coroutine_handle<BaseTaskPromise>::from_promise(*this).destroy();
+                return std::noop_coroutine();
+            }
+            std::coroutine_handle<> next = std::noop_coroutine();
+            if (state == HOOKED) {
+                JoinCounter* join = join_;
+                if (!join || join->task_done()) {
+                    next = waiter_;
+                }
+            }
+            hook_.store(FINISHED, std::memory_order_release);
+            return next;
+        }
+
         std::coroutine_handle<> waiter_;
         std::variant<
             std::monostate,
@@ -116,24 +497,25 @@ namespace coro
         Task(const Task&) = delete;
         Task& operator=(const Task&) = delete;
         ~Task() {
-            if (!handle_) {
-                return;
-            } else if (!handle_.done()) {
-                handle_.promise().result_.template emplace<3>(std::monostate{});
-            } else {
+            if (handle_ && handle_.promise().detach()) {
                 handle_.destroy();
             }
         }
 
         bool await_ready() {
-            auto& result_ = handle_.promise().result_;
-            return result_.index() > 0;
+            return done();
         }
         
         template <typename T_, bool nothrow_>
-        void await_suspend(std::coroutine_handle<Promise<T_, nothrow_>> caller) noexcept {
-            handle_.promise().waiter_ = caller;
+        bool await_suspend(std::coroutine_handle<Promise<T_, nothrow_>> caller) noexcept {
+            return handle_.promise().hook(nullptr, caller, &caller.promise());
+        }
+
+#ifdef LIBURING_TRACE
+        trace::Await trace() const noexcept {
+            return {"join", "task", int64_t(handle_.promise().trace_id)};
         }
+#endif
 
         T await_resume() const {
             return get_result();
@@ -153,7 +535,45 @@ namespace coro
         }
 
         bool done() const {
-            return handle_.done();
+            return handle_.promise().finished();
+        }
+
+        // like get_result(), but moves the value out of the task
+        T take_result() {
+            auto& result = handle_.promise().result_;
+            if constexpr (!nothrow) {
+                if (auto* pep = std::get_if<2>(&result)) {
+                    std::rethrow_exception(*pep);
+                }
+            }
+
+            if constexpr (!std::is_void_v<T>) {
+                return std::move(*std::get_if<1>(&result));
+            }
+        }
+
+        // resume `waiter` once this task is done and `join` counted down to zero, without a frame
+        // of its own; false if the task is done already, `join` is not counted down then.
+        // unhook() forgets the waiter again. See when_all/when_any.
+        template <typename P>
+        bool join(JoinCounter* join, std::coroutine_handle<P> waiter) noexcept {
+            TaskContext* joiner = nullptr;
+            if constexpr (std::is_base_of_v<TaskContext, P>) {
+                joiner = &waiter.promise();
+            }
+            return handle_.promise().hook(join, waiter, joiner);
+        }
+
+        void unhook() noexcept {
+            handle_.promise().unhook();
+        }
+
+        // cancel the task if it is still running, see TaskContext::cancel(). Destroying a Task
+        // only detaches it, its ops keep going.
+        void cancel() noexcept {
+            if (handle_ && !done()) {
+                handle_.promise().cancel();
+            }
         }
 
     private:
@@ -166,4 +586,77 @@ namespace coro
     Task<T, nothrow> BaseTaskPromise<T, nothrow>::get_return_object() {
         return Task<T, nothrow>(static_cast<Promise<T, nothrow>*>(this));
     }
-}
\ No newline at end of file
+
+    // Bounds every op awaited by the current task, and by the tasks it starts while the scope is
+    // alive, to `deadline`; the tighter deadline wins. Ops past the deadline yield -ETIME.
+    // Outside of a task it does nothing.
+    class DeadlineScope {
+    public:
+        explicit DeadlineScope(TaskContext::time_point deadline) noexcept
+            : ctx_(TaskContext::current()) {
+            if (ctx_) {
+                previous_ = ctx_->deadline;
+                ctx_->deadline = std::min(previous_, deadline);
+            }
+        }
+
+        template <typename Rep, typename Period>
+        explicit DeadlineScope(std::chrono::duration<Rep, Period> duration) noexcept
+            : DeadlineScope(std::chrono::steady_clock::now()
+                + std::chrono::duration_cast<std::chrono::steady_clock::duration>(duration)) {}
+
+        DeadlineScope(const DeadlineScope&) = delete;
+        DeadlineScope& operator=(const DeadlineScope&) = delete;
+
+        ~DeadlineScope() {
+            if (ctx_) {
+                ctx_->deadline = previous_;
+            }
+        }
+
+    private:
+        TaskContext* ctx_;
+        TaskContext::time_point previous_;
+    };
+
+    // Hands `token` to the current task and the tasks it starts while the scope is alive; a stop
+    // requested on it cancels the task, see TaskContext::cancel(). A stop requested on another
+    // thread than the one which made the scope can't touch the ring: the task only notices it
+    // the next time it suspends. Outside of a task it does nothing.
+    class StopScope {
+    public:
+        explicit StopScope(std::stop_token token)
+            : ctx_(TaskContext::current()) {
+            if (ctx_) {
+                previous_ = std::exchange(ctx_->stop_token, token);
+                callback_.emplace(std::move(token), Canceller{ctx_, std::this_thread::get_id()});
+            }
+        }
+
+        StopScope(const StopScope&) = delete;
+        StopScope& operator=(const StopScope&) = delete;
+
+        ~StopScope() {
+            if (ctx_) {
+                callback_.reset();
+                ctx_->stop_token = std::move(previous_);
+            }
+        }
+
+    private:
+        struct Canceller {
+            TaskContext* ctx;
+            std::thread::id owner;
+
+            void operator()() const noexcept {
+                if (std::this_thread::get_id() == owner) {
+                    ctx->cancel();
+                }
+            }
+        };
+
+        TaskContext* ctx_;
+        std::stop_token previous_;
+        std::optional<std::stop_callback<Canceller>> callback_;
+    };
+}
@@ -0,0 +1,301 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cerrno>
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+
+#ifdef LIBURING_TRACE
+#include "trace.hpp"
+#endif
+
+namespace coro {
+class IOService;
+class Timer;
+
+// A timer linked into a TimerWheel, embedded in whatever waits on it (see SleepAwaitable).
+struct TimerNode {
+    // unlink from whatever list the node is on
+    void unlink() noexcept {
+        prev->next = next;
+        next->prev = prev;
+        prev = next = this;
+    }
+
+    [[nodiscard]]
+    bool linked() const noexcept {
+        return next != this;
+    }
+
+    TimerNode* prev = this;
+    TimerNode* next = this;
+    uint64_t expires = 0;           // tick
+    int slot = -1;                  // wheel slot, -1 when due or idle
+    std::coroutine_handle<> handle;
+    int result = 0;                 // -ETIME once expired, -ECANCELED once cancelled
+};
+
+// Hierarchical timer wheel: LEVELS wheels of 64 slots, level l covering 64^l ticks per slot.
+// Timers are inserted, cancelled and expired in O(1); a slot of a higher level is spread over
+// the lower ones when time reaches it. Timers further away than the top level covers wait in its
+// last slot and are placed again on the way.
+// Expired and cancelled timers are moved to a due list and resumed by fire_due(), never from
+// inside insert() or cancel().
+class TimerWheel {
+public:
+    static constexpr unsigned LEVELS = 5;   // 2^30 ticks, 12 days at 1ms
+    static constexpr unsigned SLOTS = 64;
+
+    TimerWheel() noexcept = default;
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    // schedule `node` to expire at tick `expires`, at the earliest on the next tick
+    void insert(TimerNode& node, uint64_t expires) noexcept {
+        node.expires = expires > now_ ? expires : now_ + 1;
+        node.result = 0;
+        place(node);
+        ++size_;
+    }
+
+    // move a pending timer to the due list with -ECANCELED; false if it isn't pending
+    bool cancel(TimerNode& node) noexcept {
+        if (node.slot < 0) {
+            return false;
+        }
+        unlink(node);
+        node.result = -ECANCELED;
+        push(due_, node);
+        return true;
+    }
+
+    // forget `node` wherever it is, its waiter won't be resumed
+    void remove(TimerNode& node) noexcept {
+        if (node.slot >= 0) {
+            unlink(node);
+            --size_;
+        } else if (node.linked()) {
+            node.unlink();
+            --size_;
+        }
+    }
+
+    // move every timer expiring at or before tick `now` to the due list
+    void advance(uint64_t now) noexcept {
+        while (now_ < now) {
+            uint64_t tick = next_tick();
+            if (tick > now) {
+                now_ = now;
+                break;
+            }
+            now_ = tick;
+            // spread the higher slots reached by this tick, top down, then expire level 0
+            for (unsigned level = LEVELS - 1; level > 0; --level) {
+                if (!(tick & (span(level) - 1))) {
+                    cascade(level, unsigned(tick >> (6 * level)) & (SLOTS - 1));
+                }
+            }
+            auto& head = slots_[0][tick & (SLOTS - 1)];
+            while (head.linked()) {
+                auto& node = *head.next;
+                unlink(node);
+                node.result = -ETIME;
+                push(due_, node);
+            }
+        }
+    }
+
+    // resume the waiters of every due timer
+    void fire_due() noexcept {
+        while (due_.linked()) {
+            auto& node = *due_.next;
+            node.unlink();
+            --size_;
+            node.handle.resume();
+        }
+    }
+
+    // the next tick at which advance() has work to do, UINT64_MAX if none
+    [[nodiscard]]
+    uint64_t next_tick() const noexcept {
+        uint64_t best = UINT64_MAX;
+        for (unsigned level = 0; level < LEVELS; ++level) {
+            if (!occupied_[level]) continue;
+            uint64_t base = now_ >> (6 * level);
+            unsigned from = unsigned(base + 1) & (SLOTS - 1);
+            unsigned slot = (from + unsigned(std::countr_zero(std::rotr(occupied_[level], int(from))))) & (SLOTS - 1);
+            uint64_t k = (base & ~uint64_t(SLOTS - 1)) | slot;
+            if (k <= base) k += SLOTS;
+            uint64_t tick = k << (6 * level);
+            if (tick < best) best = tick;
+        }
+        return best;
+    }
+
+    [[nodiscard]]
+    bool has_due() const noexcept {
+        return due_.linked();
+    }
+
+    // timers pending or due
+    [[nodiscard]]
+    size_t size() const noexcept {
+        return size_;
+    }
+
+    [[nodiscard]]
+    bool empty() const noexcept {
+        return size_ == 0;
+    }
+
+    [[nodiscard]]
+    uint64_t now() const noexcept {
+        return now_;
+    }
+
+private:
+    static constexpr uint64_t span(unsigned level) noexcept {
+        return uint64_t(1) << (6 * level);
+    }
+
+    void place(TimerNode& node) noexcept {
+        uint64_t delta = node.expires - now_;
+        unsigned level = 0;
+        while (level < LEVELS - 1 && delta >= span(level + 1)) ++level;
+        unsigned slot;
+        if (delta >= span(LEVELS)) {
+            // out of range: park in the furthest top slot, placed again once reached
+            slot = unsigned((now_ >> (6 * level)) + SLOTS - 1) & (SLOTS - 1);
+        } else {
+            slot = unsigned(node.expires >> (6 * level)) & (SLOTS - 1);
+        }
+        node.slot = int(level * SLOTS + slot);
+        push(slots_[level][slot], node);
+        occupied_[level] |= uint64_t(1) << slot;
+    }
+
+    void unlink(TimerNode& node) noexcept {
+        unsigned level = unsigned(node.slot) / SLOTS, slot = unsigned(node.slot) % SLOTS;
+        node.unlink();
+        node.slot = -1;
+        if (!slots_[level][slot].linked()) {
+            occupied_[level] &= ~(uint64_t(1) << slot);
+        }
+    }
+
+    void cascade(unsigned level, unsigned slot) noexcept {
+        auto& head = slots_[level][slot];
+        while (head.linked()) {
+            auto& node = *head.next;
+            unlink(node);
+            place(node);
+        }
+    }
+
+    static void push(TimerNode& head, TimerNode& node) noexcept {
+        node.prev = head.prev;
+        node.next = &head;
+        head.prev->next = &node;
+        head.prev = &node;
+    }
+
+    uint64_t now_ = 0;
+    size_t size_ = 0;
+    std::array<uint64_t, LEVELS> occupied_{};
+    std::array<std::array<TimerNode, SLOTS>, LEVELS> slots_{};
+    TimerNode due_;
+};
+
+// co_await service.sleep_for(...) / sleep_until(...): suspends on the service's timer wheel and
+// yields -ETIME once the deadline passed, or -ECANCELED if cancelled through a Timer or the
+// awaiting task.
+// Member functions touching the service are defined in io_service.hpp.
+class SleepAwaitable {
+public:
+    SleepAwaitable(IOService& service, std::chrono::steady_clock::time_point deadline, Timer* owner = nullptr) noexcept
+        : service_(&service), deadline_(deadline), owner_(owner) {}
+
+    SleepAwaitable(const SleepAwaitable&) = delete;
+    SleepAwaitable& operator=(const SleepAwaitable&) = delete;
+
+    // the waiting coroutine was destroyed
+    inline ~SleepAwaitable();
+
+    bool await_ready() noexcept {
+        if (deadline_ <= std::chrono::steady_clock::now()) {
+            node_.result = -ETIME;
+            return true;
+        }
+        return false;
+    }
+
+    inline void await_suspend(std::coroutine_handle<> handle) noexcept;
+    inline int await_resume() noexcept;
+
+    // see TaskContext::cancel()
+    inline void cancel() noexcept;
+
+#ifdef LIBURING_TRACE
+    trace::Await trace() const noexcept {
+        return {"sleep"};
+    }
+#endif
+
+private:
+    friend class Timer;
+
+    IOService* service_;
+    std::chrono::steady_clock::time_point deadline_;
+    Timer* owner_;
+    TimerNode node_;
+    bool cancelled_ = false;
+};
+
+// A sleep that can be cancelled: one coroutine co_awaits timer.sleep_for(...), any other one on
+// the same thread may cancel() it, which wakes the sleeper with -ECANCELED on the next loop.
+// Destroying the Timer cancels a pending sleep.
+class Timer {
+public:
+    explicit Timer(IOService& service) noexcept : service_(&service) {}
+
+    Timer(const Timer&) = delete;
+    Timer& operator=(const Timer&) = delete;
+
+    ~Timer() {
+        if (active_) {
+            active_->owner_ = nullptr;
+            cancel();
+        }
+    }
+
+    [[nodiscard]]
+    SleepAwaitable sleep_until(std::chrono::steady_clock::time_point deadline) noexcept {
+        return SleepAwaitable(*service_, deadline, this);
+    }
+
+    template <typename Rep, typename Period>
+    [[nodiscard]]
+    SleepAwaitable sleep_for(std::chrono::duration<Rep, Period> duration) noexcept {
+        return sleep_until(std::chrono::steady_clock::now() + duration);
+    }
+
+    // true if a sleep was pending
+    inline bool cancel() noexcept;
+
+    // whether a coroutine is sleeping on this timer
+    [[nodiscard]]
+    bool pending() const noexcept {
+        return active_ && active_->node_.slot >= 0;
+    }
+
+private:
+    friend class SleepAwaitable;
+
+    IOService* service_;
+    SleepAwaitable* active_ = nullptr;
+};
+
+}
@@ -0,0 +1,254 @@
+#pragma once
+
+// Task and await tracing, compiled in with LIBURING_TRACE. Every task is an async track in the
+// Chrome trace viewer (chrome://tracing, ui.perfetto.dev): a span from creation to final_suspend
+// with the creating task as `parent`, holding one nested span per suspension named after what it
+// awaited, e.g. the opcode and fd of an sqe or the number of tasks of a when_all. Each thread
+// records into its own buffer without locks; write_chrome_json() collects them, or set
+// LIBURING_TRACE_FILE to have the trace written at exit.
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+#include <unistd.h>
+
+namespace coro::trace {
+
+// what a suspended task waits for, see ContextAwaiter; awaiters describe themselves with a
+// `trace::Await trace() const` member
+struct Await {
+    const char* name = "await";
+    const char* arg_name = nullptr;
+    int64_t arg = 0;
+};
+
+struct Event {
+    uint64_t ts_ns;
+    uint64_t id;                // task
+    const char* name;
+    const char* arg_name;       // null if none
+    int64_t arg;
+    char phase;                 // Chrome trace phase: 'b' begin, 'e' end
+};
+
+// Events of one thread in a list of fixed chunks: the thread appends and publishes each event
+// with a release store of the chunk's size, a reader on another thread sees whole events only.
+// Chunks stay until clear().
+class ThreadBuffer {
+public:
+    static constexpr size_t CHUNK = 4096;
+
+    explicit ThreadBuffer(size_t max_chunks) : max_chunks_(max_chunks), tid_(int(gettid())) {
+        head_ = tail_ = new Chunk();
+    }
+
+    ~ThreadBuffer() {
+        free_chunks();
+    }
+
+    ThreadBuffer(const ThreadBuffer&) = delete;
+    ThreadBuffer& operator=(const ThreadBuffer&) = delete;
+
+    void record(const Event& event) noexcept {
+        size_t n = tail_->size.load(std::memory_order_relaxed);
+        if (n == CHUNK) [[unlikely]] {
+            if (chunks_ == max_chunks_) {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            auto* chunk = new (std::nothrow) Chunk();
+            if (!chunk) {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            tail_->next.store(chunk, std::memory_order_release);
+            tail_ = chunk;
+            ++chunks_;
+            n = 0;
+        }
+        tail_->events[n] = event;
+        tail_->size.store(n + 1, std::memory_order_release);
+    }
+
+    template <typename Fn>
+    void for_each(Fn&& fn) const {
+        for (auto* chunk = head_; chunk; chunk = chunk->next.load(std::memory_order_acquire)) {
+            size_t n = chunk->size.load(std::memory_order_acquire);
+            for (size_t i = 0; i < n; ++i) {
+                fn(chunk->events[i]);
+            }
+        }
+    }
+
+    // only while the thread records nothing
+    void clear() {
+        free_chunks();
+        head_ = tail_ = new Chunk();
+        chunks_ = 1;
+        dropped_.store(0, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]]
+    int tid() const noexcept {
+        return tid_;
+    }
+
+    [[nodiscard]]
+    uint64_t dropped() const noexcept {
+        return dropped_.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Chunk {
+        std::atomic<size_t> size{0};
+        std::atomic<Chunk*> next{nullptr};
+        Event events[CHUNK];
+    };
+
+    void free_chunks() noexcept {
+        for (auto* chunk = head_; chunk;) {
+            delete std::exchange(chunk, chunk->next.load(std::memory_order_relaxed));
+        }
+    }
+
+    Chunk* head_;
+    Chunk* tail_;
+    size_t chunks_ = 1;
+    size_t max_chunks_;
+    int tid_;
+    std::atomic<uint64_t> dropped_{0};
+};
+
+// All thread buffers of the process, kept after their threads exit so their events still get
+// written. Writes LIBURING_TRACE_FILE on destruction, at exit.
+class Registry {
+public:
+    // per thread, 64 chunks of 4096 events: 256Ki events, ~12 MiB
+    static constexpr size_t MAX_CHUNKS = 64;
+
+    static Registry& get() {
+        static Registry registry;
+        return registry;
+    }
+
+    ~Registry() {
+        if (const char* path = getenv("LIBURING_TRACE_FILE")) {
+            write_chrome_json(path);
+        }
+    }
+
+    // the calling thread's buffer, registered on its first event unless attach() did that
+    // already; null if registering failed, the event is dropped then
+    ThreadBuffer* local() noexcept {
+        if (!local_) [[unlikely]] {
+            attach();
+        }
+        return local_;
+    }
+
+    // register the calling thread's buffer ahead of its first event, off the path recording
+    // events; IOService does so for the thread it is built on
+    void attach() noexcept {
+        if (local_) {
+            return;
+        }
+        try {
+            auto buffer = std::make_unique<ThreadBuffer>(MAX_CHUNKS);
+            std::lock_guard lock(mutex_);
+            local_ = buffers_.emplace_back(std::move(buffer)).get();
+        } catch (...) {
+            lost_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    bool write_chrome_json(const char* path) {
+        FILE* out = fopen(path, "w");
+        if (!out) {
+            return false;
+        }
+        std::lock_guard lock(mutex_);
+        int pid = getpid();
+        uint64_t dropped = lost_.load(std::memory_order_relaxed);
+        bool first = true;
+        fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n", out);
+        for (auto& buffer : buffers_) {
+            dropped += buffer->dropped();
+            buffer->for_each([&](const Event& e) {
+                fprintf(out, "%s{\"name\":\"%s\",\"cat\":\"task\",\"ph\":\"%c\",\"id\":\"0x%llx\","
+                    "\"ts\":%.3f,\"pid\":%d,\"tid\":%d", first ? "" : ",\n", e.name, e.phase,
+                    (unsigned long long)e.id, double(e.ts_ns) / 1e3, pid, buffer->tid());
+                if (e.arg_name) {
+                    fprintf(out, ",\"args\":{\"%s\":%lld}", e.arg_name, (long long)e.arg);
+                }
+                fputc('}', out);
+                first = false;
+            });
+        }
+        fprintf(out, "\n],\"otherData\":{\"dropped_events\":%llu}}\n", (unsigned long long)dropped);
+        return fclose(out) == 0;
+    }
+
+    // only while no thread records
+    void clear() {
+        std::lock_guard lock(mutex_);
+        for (auto& buffer : buffers_) {
+            buffer->clear();
+        }
+        lost_.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers_;
+    std::atomic<uint64_t> lost_{0};     // events of threads whose buffer couldn't be registered
+    inline static thread_local ThreadBuffer* local_ = nullptr;
+};
+
+[[nodiscard]]
+inline uint64_t next_id() noexcept {
+    static std::atomic<uint64_t> ids{0};
+    return ids.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+inline void record(char phase, uint64_t id, const char* name, const char* arg_name = nullptr, int64_t arg = 0) noexcept {
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    if (auto* buffer = Registry::get().local()) [[likely]] {
+        buffer->record({uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(now).count()),
+            id, name, arg_name, arg, phase});
+    }
+}
+
+inline void task_created(uint64_t id, uint64_t parent) noexcept {
+    record('b', id, "task", "parent", int64_t(parent));
+}
+
+inline void task_done(uint64_t id) noexcept {
+    record('e', id, "task");
+}
+
+inline void await_begin(uint64_t id, const Await& await) noexcept {
+    record('b', id, await.name, await.arg_name, await.arg);
+}
+
+inline void await_end(uint64_t id, const char* name) noexcept {
+    record('e', id, name);
+}
+
+// write the events of all threads so far as Chrome trace JSON
+inline bool write_chrome_json(const char* path) {
+    return Registry::get().write_chrome_json(path);
+}
+
+// drop all events so far; no thread may be recording meanwhile
+inline void clear() {
+    Registry::get().clear();
+}
+
+}
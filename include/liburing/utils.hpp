@@ -29,7 +29,7 @@ private:
 };
 
 [[noreturn]]
-void Panic(std::string_view sv, int err) {
+inline void Panic(std::string_view sv, int err) {
 #ifndef NDEBUG
     // https://stackoverflow.com/questions/77005/how-to-automatically-generate-a-stacktrace-when-my-program-crashes
     void *array[32];
@@ -0,0 +1,224 @@
+#pragma once
+
+#include <cerrno>
+#include <coroutine>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "io_service.hpp"
+#include "utils.hpp"
+
+namespace coro {
+
+// How WalWriter makes a batch durable
+enum class WalSync {
+    datasync,   // fdatasync(): the data and the metadata needed to read it back (default)
+    fsync,      // fsync(): all metadata too
+    // sync_file_range() over the batch: no metadata and no device cache flush, durable only for
+    // preallocated files on storage with power loss protection
+    range,
+};
+
+// Appends records to a log file with group commit: appenders arriving while a batch is being
+// written and synced are gathered into the next batch, which then costs one write and one sync,
+// linked so both go to the kernel in one submission. Everyone in a batch is resumed once it is
+// durable. A record is copied into its batch when the append is awaited, not by append() itself:
+// its buffer must stay valid until co_await, after that the caller may reuse it.
+// The writer must outlive all appends in progress.
+class WalWriter {
+public:
+    // appends at `offset`, at the end of the file if negative
+    WalWriter(IOService& service, int fd, off_t offset = -1, WalSync sync = WalSync::datasync)
+        : service_(&service), fd_(fd), sync_(sync), offset_(offset) {
+        if (offset_ < 0) {
+            struct stat st;
+            fstat(fd, &st) | PanicOnErr("fstat", true);
+            offset_ = st.st_size;
+        }
+        write_done_.wal = this;
+        sync_done_.wal = this;
+    }
+
+    WalWriter(const WalWriter&) = delete;
+    WalWriter& operator=(const WalWriter&) = delete;
+
+    // Append `record` and wait until it is durable. Yields the file offset of the record, or a
+    // negative errno if its batch failed. After a failed write or sync every later append fails
+    // with the same error: whether the kernel kept the dirty pages is unknown.
+    auto append(std::span<const char> record) noexcept {
+        struct AwaitAppend {
+            WalWriter* wal;
+            std::span<const char> record;
+            off_t result = 0;
+            std::coroutine_handle<> handle;
+
+            bool await_ready() noexcept {
+                result = wal->error_;
+                return result < 0;
+            }
+
+            void await_suspend(std::coroutine_handle<> h) noexcept {
+                handle = h;
+                wal->enqueue(*this);
+            }
+
+            off_t await_resume() const noexcept {
+                return result;
+            }
+        };
+
+        return AwaitAppend{this, record};
+    }
+
+    // batches written and synced
+    [[nodiscard]]
+    uint64_t commits() const noexcept {
+        return commits_;
+    }
+
+    // records made durable
+    [[nodiscard]]
+    uint64_t records() const noexcept {
+        return records_;
+    }
+
+    // where the next batch goes
+    [[nodiscard]]
+    off_t offset() const noexcept {
+        return offset_;
+    }
+
+private:
+    struct Waiter {
+        off_t* result;
+        std::coroutine_handle<> handle;
+    };
+
+    struct Batch {
+        std::vector<char> data;
+        std::vector<Waiter> waiters;
+    };
+
+    struct Done final : public Resolver {
+        WalWriter* wal = nullptr;
+        int result = 0;
+
+        void resolve(int res, uint32_t) noexcept override {
+            result = res;
+            wal->arrived();
+        }
+    };
+
+    template <typename A>
+    void enqueue(A& awaiter) noexcept {
+        // the offset within the batch for now, made absolute once the batch is durable
+        awaiter.result = off_t(filling_.data.size());
+        filling_.data.insert(filling_.data.end(), awaiter.record.begin(), awaiter.record.end());
+        filling_.waiters.push_back({&awaiter.result, awaiter.handle});
+        if (!committing_) {
+            start();
+        }
+    }
+
+    void start() noexcept {
+        committing_ = true;
+        std::swap(filling_, syncing_);
+        written_ = 0;
+        submit();
+    }
+
+    void submit() noexcept {
+        auto& data = syncing_.data;
+        service_->reserve_sqes(2);
+        auto* sqe = service_->io_uring_get_sqe_safe();
+        io_uring_prep_write(sqe, fd_, data.data() + written_, unsigned(data.size() - written_), uint64_t(offset_) + written_);
+        io_uring_sqe_set_flags(sqe, IOSQE_IO_LINK);
+        io_uring_sqe_set_data(sqe, static_cast<Resolver*>(&write_done_));
+        service_->sqe_armed();
+
+        // a short write fails the link, the sync then completes with -ECANCELED
+        sqe = service_->io_uring_get_sqe_safe();
+        if (sync_ == WalSync::range) {
+            io_uring_prep_sync_file_range(sqe, fd_, unsigned(data.size()), uint64_t(offset_),
+                SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+        } else {
+            io_uring_prep_fsync(sqe, fd_, sync_ == WalSync::datasync ? IORING_FSYNC_DATASYNC : 0);
+        }
+        io_uring_sqe_set_data(sqe, static_cast<Resolver*>(&sync_done_));
+        service_->sqe_armed();
+        in_flight_ = 2;
+    }
+
+    // both cqes of the write + sync pair are in
+    void arrived() noexcept {
+        if (--in_flight_) {
+            return;
+        }
+
+        int result = write_done_.result;
+        if (result > 0 && written_ + size_t(result) < syncing_.data.size()) {
+            written_ += size_t(result);
+            submit();
+            return;
+        }
+        if (result >= 0) {
+            // no progress on a non-empty batch; a batch of empty records writes 0 bytes
+            result = result || syncing_.data.empty() ? sync_done_.result : -EIO;
+        }
+        if (result < 0) {
+            error_ = result;
+        }
+        finish(result);
+    }
+
+    void finish(int result) noexcept {
+        auto done = std::move(syncing_.waiters);
+        syncing_.waiters.clear();
+        off_t base = offset_;
+        ++commits_;
+        if (result >= 0) {
+            offset_ += off_t(syncing_.data.size());
+            records_ += done.size();
+        }
+        syncing_.data.clear();
+
+        if (error_ < 0) {
+            done.insert(done.end(), filling_.waiters.begin(), filling_.waiters.end());
+            filling_.waiters.clear();
+            filling_.data.clear();
+            committing_ = false;
+        } else if (filling_.waiters.empty()) {
+            committing_ = false;
+        } else {
+            start();
+        }
+
+        // the writer may be gone once the first waiter runs
+        for (auto& waiter : done) {
+            *waiter.result = result < 0 ? result : base + *waiter.result;
+            waiter.handle.resume();
+        }
+    }
+
+    IOService* service_;
+    int fd_;
+    WalSync sync_;
+    off_t offset_;
+    off_t error_ = 0;
+    bool committing_ = false;
+    unsigned in_flight_ = 0;
+    size_t written_ = 0;
+    Batch filling_;         // appends waiting for the batch in flight
+    Batch syncing_;         // the batch being written and synced
+    Done write_done_;
+    Done sync_done_;
+    uint64_t commits_ = 0;
+    uint64_t records_ = 0;
+};
+
+}
@@ -1,6 +1,5 @@
 #pragma once
 
-#include <atomic>
 #include <tuple>
 #include <variant>
 #include <coroutine>
@@ -8,6 +7,8 @@
 #include <cassert>
 #include <exception>
 #include <utility>
+#include <vector>
+#include <ranges>
 
 #include "task.hpp"
 
@@ -29,90 +30,94 @@ using task_result_type_t = typename task_result_type<T>::type;
 template <typename T>
 using non_void_type_t = std::conditional_t<std::is_void_v<T>, std::monostate, T>;
 
-// WhenAllAwaiter类 - 简化版本，修复内存管理和协程恢复问题
+// 取出已完成任务的结果（移动而非复制），void任务返回std::monostate；任务抛出的异常在此重新抛出
+template <typename TaskType>
+non_void_type_t<task_result_type_t<TaskType>> take_task_result(TaskType& task) {
+    if constexpr (std::is_void_v<task_result_type_t<TaskType>>) {
+        task.take_result();
+        return std::monostate{};
+    } else {
+        return task.take_result();
+    }
+}
+
+// 以下组合器不为每个子任务再创建协程帧：子任务完成时通过自己的waiter_直接恢复调用者（见Task::join）。
+// 挂接子任务期间调用者自己持有一个计数，挂接完成后释放；若子任务已全部完成则不挂起，直接继续。
+// 子任务可以在其他线程上完成（schedule_on、WorkStealingPool）：挂接与完成通过子任务的hook_原子地交接，
+// 挂接时已完成的子任务由调用者自己计数（Task::join返回false），此时计数器也是原子的，见JoinCounter。
+
+// WhenAllAwaiter类 - 等待所有任务完成
 template <typename... Tasks>
 class WhenAllAwaiter {
 public:
     using TasksTuple = std::tuple<Tasks...>;
     using ResultsTuple = std::tuple<non_void_type_t<task_result_type_t<std::decay_t<Tasks>>>...>;
-    
-    TasksTuple tasks_;
-    std::atomic<size_t> completed_count_{0};
-    std::atomic<bool> any_exception_{false};
-    std::exception_ptr exception_ptr_;
-    ResultsTuple results_;
-    std::coroutine_handle<> continuation_;
-    std::atomic<bool> resumed_{false};
-
-    WhenAllAwaiter(Tasks&&... tasks) 
+
+    explicit WhenAllAwaiter(Tasks&&... tasks)
         : tasks_(std::forward<Tasks>(tasks)...) {}
-    
-    bool await_ready() const noexcept { return false; }
-
-    void await_suspend(std::coroutine_handle<> continuation) {
-        continuation_ = continuation;
-        
-        // 使用索引序列展开所有任务
-        await_all_tasks(std::index_sequence_for<Tasks...>{});
-    }
-
-    // 辅助方法：使用索引序列展开所有任务
-    template <size_t... Is>
-    void await_all_tasks(std::index_sequence<Is...>) {
-        (await_task_impl<std::tuple_element_t<Is, TasksTuple>, Is>(std::get<Is>(tasks_)), ...);
-    }
-
-    template <typename TaskType, size_t I>
-    void await_task_impl(TaskType& task) {
-        // 启动一个协程来等待单个任务完成
-        [this, &task]() -> Task<> {
-            try {
-                if constexpr (!std::is_void_v<task_result_type_t<TaskType>>) {
-                    // 非void任务，存储结果
-                    std::get<I>(results_) = co_await task;
-                } else {
-                    // void任务，只需等待完成
-                    co_await task;
-                }
-            } catch (...) {
-                // 捕获异常并设置异常标志
-                if (!any_exception_.exchange(true)) {
-                    exception_ptr_ = std::current_exception();
-                }
-            }
 
-            // 增加完成计数，当所有任务完成时恢复调用者
-            // 使用原子操作确保只恢复一次
-            if (++completed_count_ == sizeof...(Tasks)) {
-                bool expected = false;
-                if (!resumed_.exchange(true)) {
-                    continuation_.resume();
-                }
-            }
-        }();
+    WhenAllAwaiter(const WhenAllAwaiter&) = delete;
+    WhenAllAwaiter& operator=(const WhenAllAwaiter&) = delete;
+
+    ~WhenAllAwaiter() {
+        // 调用者在子任务完成之前被销毁：解除挂接，子任务变为分离状态
+        std::apply([](auto&... task) { (unhook(task), ...); }, tasks_);
     }
 
-    auto await_resume() {
-        // 如果有异常，抛出第一个遇到的异常
-        if (any_exception_) {
-            std::rethrow_exception(exception_ptr_);
-        }
+    bool await_ready() const noexcept {
+        return std::apply([](auto&... task) { return (task.done() && ...); }, tasks_);
+    }
+
+    template <typename P>
+    bool await_suspend(std::coroutine_handle<P> continuation) noexcept {
+        // 子任务都已开始运行，只需挂接尚未完成的那些，最后一个完成的恢复调用者
+        join_.reset(1);
+        std::apply([&](auto&... task) {
+            ((task.done() ? void() : hook(task, continuation)), ...);
+        }, tasks_);
+        return !join_.arrive();
+    }
+
+    // 取消所有未完成的任务，见TaskContext::cancel()
+    void cancel() noexcept {
+        std::apply([](auto&... task) { (task.cancel(), ...); }, tasks_);
+    }
 
-        // 特殊情况：单个任务时直接返回结果
+#ifdef LIBURING_TRACE
+    // 扇出：子任务的task事件以调用者为parent；扇入：本次等待结束
+    trace::Await trace() const noexcept {
+        return {"when_all", "tasks", int64_t(sizeof...(Tasks))};
+    }
+#endif
+
+    auto await_resume() {
+        // 按顺序取出结果，第一个失败任务的异常被重新抛出
         if constexpr (sizeof...(Tasks) == 1) {
-            using FirstTaskType = std::tuple_element_t<0, TasksTuple>;
-            using FirstResultType = task_result_type_t<FirstTaskType>;
-            
-            if constexpr (std::is_void_v<FirstResultType>) {
-                return;
-            } else {
-                return std::get<0>(results_);
-            }
+            // 特殊情况：单个任务时直接返回结果
+            return std::get<0>(tasks_).take_result();
         } else {
-            // 多个任务时返回结果元组
-            return results_;
+            return std::apply([](auto&... task) { return ResultsTuple{take_task_result(task)...}; }, tasks_);
+        }
+    }
+
+private:
+    template <typename TaskType, typename P>
+    void hook(TaskType& task, std::coroutine_handle<P> continuation) noexcept {
+        join_.add();
+        if (!task.join(&join_, continuation)) {
+            join_.arrive();
+        }
+    }
+
+    template <typename TaskType>
+    static void unhook(TaskType& task) noexcept {
+        if (!task.done()) {
+            task.unhook();
         }
     }
+
+    TasksTuple tasks_;
+    JoinCounter join_;
 };
 
 // when_all实现 - 等待所有任务完成并收集结果
@@ -121,90 +126,193 @@ auto when_all(Tasks&&... tasks) {
     return WhenAllAwaiter<std::decay_t<Tasks>...>(std::forward<Tasks>(tasks)...);
 }
 
-// WhenAnyAwaiter类 - 简化版本，修复内存管理和协程恢复问题
-template <typename... Tasks>
-class WhenAnyAwaiter {
+// WhenAllRangeAwaiter类 - 等待数量在运行时确定的任务，结果按下标写入预先分配好的vector
+template <typename T, bool nothrow>
+class WhenAllRangeAwaiter {
 public:
-    using TasksTuple = std::tuple<Tasks...>;
-    using ResultVariant = std::variant<non_void_type_t<task_result_type_t<std::decay_t<Tasks>>>...>;
-    
-    TasksTuple tasks_;
-    std::atomic<bool> completed_{false};
-    size_t completed_index_{0};
-    std::exception_ptr exception_ptr_;
-    ResultVariant result_;
-    std::coroutine_handle<> continuation_;
+    using ResultType = non_void_type_t<T>;
 
-    WhenAnyAwaiter(Tasks&&... tasks) 
-        : tasks_(std::forward<Tasks>(tasks)...) {}
-    
-    bool await_ready() const noexcept { return false; }
-
-    void await_suspend(std::coroutine_handle<> continuation) {
-        continuation_ = continuation;
-        
-        // 使用索引序列展开所有任务
-        await_all_tasks(std::index_sequence_for<Tasks...>{});
-    }
-
-    // 辅助方法：使用索引序列展开所有任务
-    template <size_t... Is>
-    void await_all_tasks(std::index_sequence<Is...>) {
-        (await_task_impl<std::tuple_element_t<Is, TasksTuple>, Is>(std::get<Is>(tasks_)), ...);
-    }
-
-    template <typename TaskType, size_t I>
-    void await_task_impl(TaskType& task) {
-        [this, &task]() -> Task<> {
-            try {
-                if constexpr (!std::is_void_v<task_result_type_t<TaskType>>) {
-                    // 非void任务，获取结果
-                    auto value = co_await task;
-                    
-                    // 检查是否是第一个完成的任务
-                    bool expected = false;
-                    if (completed_.compare_exchange_strong(expected, true)) {
-                        completed_index_ = I;
-                        result_.template emplace<I>(std::move(value));
-                        continuation_.resume();
-                    }
-                } else {
-                    // void任务，只需等待完成
-                    co_await task;
-                    
-                    // 检查是否是第一个完成的任务
-                    bool expected = false;
-                    if (completed_.compare_exchange_strong(expected, true)) {
-                        completed_index_ = I;
-                        result_.template emplace<I>(std::monostate{});
-                        continuation_.resume();
-                    }
-                }
-            } catch (...) {
-                // 检查是否是第一个遇到异常的任务
-                bool expected = false;
-                if (completed_.compare_exchange_strong(expected, true)) {
-                    exception_ptr_ = std::current_exception();
-                    continuation_.resume();
+    explicit WhenAllRangeAwaiter(std::vector<Task<T, nothrow>>&& tasks)
+        : tasks_(std::move(tasks)) {}
+
+    WhenAllRangeAwaiter(const WhenAllRangeAwaiter&) = delete;
+    WhenAllRangeAwaiter& operator=(const WhenAllRangeAwaiter&) = delete;
+
+    ~WhenAllRangeAwaiter() {
+        for (auto& task : tasks_) {
+            if (!task.done()) task.unhook();
+        }
+    }
+
+    bool await_ready() const noexcept {
+        for (auto& task : tasks_) {
+            if (!task.done()) return false;
+        }
+        return true;
+    }
+
+    template <typename P>
+    bool await_suspend(std::coroutine_handle<P> continuation) noexcept {
+        join_.reset(1);
+        for (auto& task : tasks_) {
+            if (!task.done()) {
+                join_.add();
+                if (!task.join(&join_, continuation)) {
+                    join_.arrive();
                 }
             }
-        }();
+        }
+        return !join_.arrive();
+    }
+
+    // 取消所有未完成的任务，见TaskContext::cancel()
+    void cancel() noexcept {
+        for (auto& task : tasks_) {
+            task.cancel();
+        }
+    }
+
+#ifdef LIBURING_TRACE
+    trace::Await trace() const noexcept {
+        return {"when_all", "tasks", int64_t(tasks_.size())};
+    }
+#endif
+
+    auto await_resume() {
+        if constexpr (!std::is_void_v<T>) {
+            std::vector<ResultType> results;
+            results.reserve(tasks_.size());
+            for (auto& task : tasks_) {
+                results.push_back(task.take_result());
+            }
+            return results;
+        } else {
+            for (auto& task : tasks_) {
+                task.take_result();
+            }
+        }
     }
 
+private:
+    std::vector<Task<T, nothrow>> tasks_;
+    JoinCounter join_;
+};
+
+// when_all的动态版本 - 等待vector中的所有任务，返回与之一一对应的结果vector（void任务不返回结果）
+template <typename T, bool nothrow>
+auto when_all(std::vector<Task<T, nothrow>> tasks) {
+    return WhenAllRangeAwaiter<T, nothrow>(std::move(tasks));
+}
+
+// 对range中的每个元素执行co_await fn(element)，同时最多有limit个在进行中。
+// 由limit个工作协程依次从range中领取元素，因此提交的sqe数量有上限，不会一次性塞满ring。
+// range必须在返回的任务完成之前保持有效；有异常时等所有工作协程结束后抛出第一个异常。
+// 任务被取消后，工作协程不再领取新的元素。
+template <std::ranges::forward_range Range, typename Fn>
+Task<> for_each_concurrent(Range&& range, size_t limit, Fn fn) {
+    auto it = std::ranges::begin(range);
+    auto end = std::ranges::end(range);
+    if (limit == 0) {
+        limit = 1;
+    }
+
+    auto worker = [&]() -> Task<> {
+        while (it != end && !TaskContext::current()->stop_requested()) {
+            auto&& element = *it;
+            ++it;
+            co_await fn(element);
+        }
+    };
+
+    std::vector<Task<>> workers;
+    workers.reserve(limit);
+    for (size_t i = 0; i < limit && it != end; ++i) {
+        workers.push_back(worker());
+    }
+    co_await when_all(std::move(workers));
+}
+
+// WhenAnyAwaiter类 - 等待任意一个任务完成，其余任务随即被取消
+template <typename... Tasks>
+class WhenAnyAwaiter {
+public:
+    using TasksTuple = std::tuple<Tasks...>;
+    using ResultVariant = std::variant<non_void_type_t<task_result_type_t<std::decay_t<Tasks>>>...>;
+
     // 返回结果结构体，包含索引和值
     struct WhenAnyResult {
         size_t index; // 完成的任务索引
         ResultVariant value; // 完成任务的结果
     };
 
+    explicit WhenAnyAwaiter(Tasks&&... tasks)
+        : tasks_(std::forward<Tasks>(tasks)...) {}
+
+    WhenAnyAwaiter(const WhenAnyAwaiter&) = delete;
+    WhenAnyAwaiter& operator=(const WhenAnyAwaiter&) = delete;
+
+    ~WhenAnyAwaiter() {
+        // 未完成的任务不再恢复调用者，它们被取消后自行结束
+        unhook_all();
+    }
+
+    bool await_ready() const noexcept {
+        return std::apply([](auto&... task) { return (task.done() || ...); }, tasks_);
+    }
+
+    template <typename P>
+    bool await_suspend(std::coroutine_handle<P> continuation) noexcept {
+        // 计数为2（调用者自己的加上第一个完成的任务）：之后完成的任务不再计数
+        join_.reset(2, true);
+        // 挂接时发现某个任务已在其他线程上完成：不再挂接，解除已挂接的任务后直接继续
+        bool ready = false;
+        std::apply([&](auto&... task) { ((ready = ready || !task.join(&join_, continuation)), ...); }, tasks_);
+        if (ready) {
+            unhook_all();
+            return false;
+        }
+        return !join_.arrive();
+    }
+
+    // 取消所有未完成的任务：第一个任务完成后，其余任务的内核操作在下一轮循环内被取消
+    void cancel() noexcept {
+        std::apply([](auto&... task) { (task.cancel(), ...); }, tasks_);
+    }
+
+#ifdef LIBURING_TRACE
+    trace::Await trace() const noexcept {
+        return {"when_any", "tasks", int64_t(sizeof...(Tasks))};
+    }
+#endif
+
     WhenAnyResult await_resume() {
-        // 如果有异常，抛出
-        if (exception_ptr_) {
-            std::rethrow_exception(exception_ptr_);
+        cancel();
+        // 下标最小的已完成任务即为结果
+        size_t index = std::apply([](auto&... task) {
+            size_t i = 0;
+            ((task.done() ? false : (++i, true)) && ...);
+            return i;
+        }, tasks_);
+        return {index, take_winner(index)};
+    }
+
+private:
+    void unhook_all() noexcept {
+        std::apply([](auto&... task) { ((task.done() ? void() : task.unhook()), ...); }, tasks_);
+    }
+
+    template <size_t I = 0>
+    ResultVariant take_winner(size_t index) {
+        if constexpr (I + 1 < sizeof...(Tasks)) {
+            if (index != I) {
+                return take_winner<I + 1>(index);
+            }
         }
-        
-        return {completed_index_, result_};
+        return ResultVariant(std::in_place_index<I>, take_task_result(std::get<I>(tasks_)));
     }
+
+    TasksTuple tasks_;
+    JoinCounter join_;
 };
 
 // when_any实现 - 等待任意一个任务完成并返回其结果
@@ -213,4 +321,4 @@ auto when_any(Tasks&&... tasks) {
     return WhenAnyAwaiter<std::decay_t<Tasks>...>(std::forward<Tasks>(tasks)...);
 }
 
-} // namespace coro
\ No newline at end of file
+} // namespace coro
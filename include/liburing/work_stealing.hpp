@@ -0,0 +1,262 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <type_traits>
+#include <variant>
+#include <vector>
+#include <liburing.h>
+
+#include "io_service.hpp"
+#include "schedule_on.hpp"
+#include "task.hpp"
+#include "utils.hpp"
+
+namespace coro {
+
+// Chase-Lev work-stealing deque (the C11 formulation by Le et al.) with a fixed capacity.
+// The owner pushes and pops at the bottom, any other thread steals from the top.
+template <typename T, size_t Capacity = 4096>
+class ChaseLevDeque {
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of 2");
+    static_assert(std::is_trivially_copyable_v<T>);
+
+public:
+    // owner only; false when the deque is full
+    bool push(T item) noexcept {
+        int64_t b = bottom_.load(std::memory_order_relaxed);
+        int64_t t = top_.load(std::memory_order_acquire);
+        if (b - t >= int64_t(Capacity)) [[unlikely]] {
+            return false;
+        }
+        buffer_[b & (Capacity - 1)].store(item, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom_.store(b + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // owner only, LIFO end
+    bool pop(T& item) noexcept {
+        int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+        bottom_.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top_.load(std::memory_order_relaxed);
+
+        if (t > b) {
+            bottom_.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+        item = buffer_[b & (Capacity - 1)].load(std::memory_order_relaxed);
+        if (t == b) {
+            // last item, race the thieves for it
+            bool won = top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            bottom_.store(b + 1, std::memory_order_relaxed);
+            return won;
+        }
+        return true;
+    }
+
+    // any thread, FIFO end
+    bool steal(T& item) noexcept {
+        int64_t t = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom_.load(std::memory_order_acquire);
+        if (t >= b) {
+            return false;
+        }
+        item = buffer_[t & (Capacity - 1)].load(std::memory_order_relaxed);
+        return top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+    }
+
+    // racy hint, good enough to decide whether to sleep
+    [[nodiscard]]
+    bool empty() const noexcept {
+        return bottom_.load(std::memory_order_seq_cst) <= top_.load(std::memory_order_seq_cst);
+    }
+
+private:
+    alignas(64) std::atomic<int64_t> top_{0};
+    alignas(64) std::atomic<int64_t> bottom_{0};
+    alignas(64) std::array<std::atomic<T>, Capacity> buffer_{};
+};
+
+// Optional work-stealing layer over a set of rings, one Chase-Lev deque per ring.
+// offload() queues the coroutine on its ring, where any idle ring may pick it up, runs a
+// CPU-heavy function there and brings the coroutine back to its ring afterwards, so I/O keeps
+// being issued and completed on the owning ring.
+class WorkStealingPool {
+public:
+    explicit WorkStealingPool(unsigned workers) {
+        for (unsigned i = 0; i < workers; ++i) {
+            workers_.push_back(std::make_unique<Worker>(this, i));
+        }
+    }
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    // make `service` worker `index` of the pool; call on the thread running `service`, e.g. at
+    // the top of the function handed to Runtime::start()
+    void attach(IOService& service, unsigned index) noexcept {
+        auto& worker = *workers_[index];
+        worker.service_.store(&service, std::memory_order_release);
+        service.set_run_queue(&worker);
+        local_ = &worker;
+    }
+
+    // run `fn` on whichever ring gets to it first, then resume on the calling ring
+    template <typename Fn, typename R = std::invoke_result_t<Fn&>>
+    Task<R> offload(Fn fn) {
+        auto* home = IOService::current();
+        if (!home) [[unlikely]] {
+            Panic("offload: no IOService on this thread", EINVAL);
+        }
+        co_await schedule();
+
+        std::exception_ptr error;
+        std::conditional_t<std::is_void_v<R>, std::monostate, std::optional<R>> result;
+        try {
+            if constexpr (std::is_void_v<R>) {
+                fn();
+            } else {
+                result.emplace(fn());
+            }
+        } catch (...) {
+            error = std::current_exception();
+        }
+
+        co_await schedule_on(*home);
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        if constexpr (!std::is_void_v<R>) {
+            co_return std::move(*result);
+        }
+    }
+
+    // coroutines resumed by worker `index` after stealing them from a peer
+    [[nodiscard]]
+    uint64_t stolen(unsigned index) const noexcept {
+        return workers_[index]->stolen_.load(std::memory_order_relaxed);
+    }
+
+    // coroutines resumed by worker `index` in total
+    [[nodiscard]]
+    uint64_t executed(unsigned index) const noexcept {
+        return workers_[index]->executed_.load(std::memory_order_relaxed);
+    }
+
+private:
+    // Queue the awaiting coroutine on the calling ring, any idle ring may pick it up. Private:
+    // the coroutine must not stay on a foreign ring, offload() brings it back home.
+    auto schedule() noexcept {
+        return AwaitSchedule{};
+    }
+
+    struct AwaitSchedule {
+        static constexpr bool migrates = true;
+
+        constexpr bool await_ready() const noexcept {
+            return false;
+        }
+
+        bool await_suspend(std::coroutine_handle<> handle) noexcept {
+            auto* worker = local_;
+            if (!worker || !worker->deque_.push(handle.address())) [[unlikely]] {
+                // not a pool thread or the deque is full, just keep running here
+                return false;
+            }
+            worker->pool_->wake_one(worker->index_);
+            return true;
+        }
+
+        constexpr void await_resume() const noexcept {}
+    };
+
+    struct Worker final : public RunQueue {
+        Worker(WorkStealingPool* pool, unsigned index) noexcept : pool_(pool), index_(index) {}
+
+        void run_some() noexcept override {
+            sleeping_.store(false, std::memory_order_relaxed);
+
+            // a bounded batch, so completions on this ring don't starve
+            void* address;
+            unsigned n = 0;
+            while (n < BATCH && deque_.pop(address)) {
+                ++n;
+                std::coroutine_handle<>::from_address(address).resume();
+            }
+            if (n == 0 && pool_->steal(index_, address)) {
+                ++n;
+                stolen_.fetch_add(1, std::memory_order_relaxed);
+                std::coroutine_handle<>::from_address(address).resume();
+            }
+            executed_.fetch_add(n, std::memory_order_relaxed);
+        }
+
+        bool prepare_wait() noexcept override {
+            sleeping_.store(true, std::memory_order_seq_cst);
+            if (pool_->has_work()) {
+                sleeping_.store(false, std::memory_order_relaxed);
+                return false;
+            }
+            return true;
+        }
+
+        static constexpr unsigned BATCH = 64;
+
+        WorkStealingPool* pool_;
+        unsigned index_;
+        std::atomic<IOService*> service_{nullptr};
+        std::atomic<bool> sleeping_{false};
+        std::atomic<uint64_t> stolen_{0};
+        std::atomic<uint64_t> executed_{0};
+        ChaseLevDeque<void*> deque_;
+    };
+
+    bool steal(unsigned thief, void*& address) noexcept {
+        for (size_t i = 1; i < workers_.size(); ++i) {
+            if (workers_[(thief + i) % workers_.size()]->deque_.steal(address)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool has_work() const noexcept {
+        for (auto& worker : workers_) {
+            if (!worker->deque_.empty()) return true;
+        }
+        return false;
+    }
+
+    // kick one sleeping peer out of io_uring_enter with an empty MSG_RING cqe
+    void wake_one(unsigned from) noexcept {
+        // pairs with prepare_wait(): either the peer sees the item pushed or we see it sleeping
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto* source = IOService::current();
+        for (size_t i = 1; i < workers_.size(); ++i) {
+            auto& peer = *workers_[(from + i) % workers_.size()];
+            auto* target = peer.service_.load(std::memory_order_acquire);
+            if (target && peer.sleeping_.load(std::memory_order_seq_cst)
+                && peer.sleeping_.exchange(false, std::memory_order_seq_cst)) {
+                auto* sqe = source->io_uring_get_sqe_safe();
+                io_uring_prep_msg_ring(sqe, target->get_handle().ring_fd, 0, 0, 0);
+                io_uring_sqe_set_data(sqe, nullptr);
+                io_uring_sqe_set_flags(sqe, IOSQE_CQE_SKIP_SUCCESS);
+                source->sqe_armed();
+                return;
+            }
+        }
+    }
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    inline static thread_local Worker* local_ = nullptr;
+};
+
+}
@@ -0,0 +1,71 @@
+#include <liburing/utils.hpp>
+#include <liburing/io_service.hpp>
+#include <liburing/when_all_any.hpp>
+#include <chrono>
+#include <iostream>
+#include <stop_token>
+#include <unistd.h>
+
+#include "io_utils.h"
+
+using namespace std::chrono_literals;
+
+auto stoppable_read(coro::IOService& service, int fd, std::stop_token token) -> coro::Task<int> {
+    coro::StopScope scope(token);
+    co_return co_await idle_read(service, fd);
+}
+
+auto short_sleep(coro::IOService& service) -> coro::Task<int> {
+    co_return co_await service.sleep_for(50ms);
+}
+
+auto run(coro::IOService& service) -> coro::Task<> {
+    int fds[2];
+    pipe(fds) | coro::PanicOnErr("pipe", true);
+
+    // Task::cancel() reaches the read awaited by a nested task
+    {
+        auto reader = idle_read(service, fds[0]);
+        co_await service.yield();
+        reader.cancel();
+        check(co_await reader, -ECANCELED, "Task::cancel on an idle read");
+    }
+
+    // so does a stop requested on the token of a StopScope
+    {
+        std::stop_source source;
+        auto reader = stoppable_read(service, fds[0], source.get_token());
+        co_await service.yield();
+        source.request_stop();
+        check(co_await reader, -ECANCELED, "request_stop on an idle read");
+    }
+
+    // a stop requested before the task awaits anything fails its first op
+    {
+        std::stop_source source;
+        source.request_stop();
+        check(co_await stoppable_read(service, fds[0], source.get_token()), -ECANCELED, "stopped before the read");
+    }
+
+    // when_any cancels the losers: the idle read is gone by the time the loser task finishes
+    {
+        auto reader = idle_read(service, fds[0]);
+        auto [index, value] = co_await coro::when_any(short_sleep(service), std::move(reader));
+        check(int(index), 0, "when_any winner");
+        co_await service.yield();
+        co_await service.yield();
+    }
+
+    // the pipe is still usable, no read is left to steal the data
+    co_await service.write(fds[1], "hi", 2, 0) | coro::PanicOnErr("write", false);
+    check(co_await idle_read(service, fds[0]), 2, "read after the cancellations");
+
+    co_await service.close(fds[0]);
+    co_await service.close(fds[1]);
+}
+
+int main() {
+    coro::IOService service;
+    service.run(run(service));
+    std::cout << "cancel: all good" << std::endl;
+}
@@ -0,0 +1,73 @@
+#include <liburing/utils.hpp>
+#include <liburing/io_service.hpp>
+#include <array>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <unistd.h>
+
+#include "io_utils.h"
+
+using namespace std::chrono_literals;
+
+auto run(coro::IOService& service) -> coro::Task<> {
+    int fds[2];
+    pipe(fds) | coro::PanicOnErr("pipe", true);
+    std::array<char, 64> buffer;
+
+    // a single op bounded by with_deadline()
+    auto start = std::chrono::steady_clock::now();
+    int r = co_await coro::with_deadline(service.read(fds[0], buffer.data(), buffer.size(), 0), 100ms);
+    check(r, -ETIME, "with_deadline on an idle pipe");
+    if (std::chrono::steady_clock::now() - start > 1s) {
+        throw std::runtime_error("with_deadline: fired way too late");
+    }
+
+    // an op finishing in time is unaffected
+    co_await service.write(fds[1], "hi", 2, 0) | coro::PanicOnErr("write", false);
+    r = co_await coro::with_deadline(service.read(fds[0], buffer.data(), buffer.size(), 0), 1s);
+    check(r, 2, "with_deadline on a ready pipe");
+
+    // an op with other sqes prepared behind it is moved next to its timeout
+    auto late = coro::with_deadline(service.read(fds[0], buffer.data(), buffer.size(), 0), 100ms);
+    service.yield().set_callback([](int) {});
+    check(co_await late, -ETIME, "with_deadline on an op prepared before another");
+
+    // cancelling a bounded op is told apart from its deadline passing
+    {
+        coro::DeadlineScope scope(10s);
+        auto reader = idle_read(service, fds[0]);
+        co_await service.yield();
+        reader.cancel();
+        check(co_await reader, -ECANCELED, "cancel an op bounded by a deadline");
+    }
+
+    // an op heading a link chain can't be bounded, it fails and takes its chain with it
+    int next = 0;
+    auto head = coro::with_deadline(service.read(fds[0], buffer.data(), buffer.size(), 0, IOSQE_IO_LINK), 1s);
+    service.yield().set_callback([&next](int r) { next = r; });
+    check(co_await head, -EINVAL, "with_deadline on the head of a link chain");
+    co_await service.yield();
+    check(next, -ECANCELED, "the rest of the chain");
+
+    // a scoped deadline reaches ops awaited in nested tasks
+    {
+        coro::DeadlineScope scope(100ms);
+        r = co_await idle_read(service, fds[0]);
+        check(r, -ETIME, "DeadlineScope in a nested task");
+    }
+
+    // and is gone once the scope ends
+    co_await service.write(fds[1], "bye", 3, 0) | coro::PanicOnErr("write", false);
+    r = co_await idle_read(service, fds[0]);
+    check(r, 3, "after the scope");
+
+    co_await service.close(fds[0]);
+    co_await service.close(fds[1]);
+}
+
+int main() {
+    coro::IOService service;
+    service.run(run(service));
+    std::cout << "deadline: all good" << std::endl;
+}
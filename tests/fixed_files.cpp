@@ -0,0 +1,68 @@
+#include <liburing/utils.hpp>
+#include <liburing/io_service.hpp>
+#include <array>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string_view>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "io_utils.h"
+
+auto run(coro::IOService& service) -> coro::Task<> {
+    std::array<char, 64> buffer{};
+
+    // a file opened straight into the table, never getting a plain fd
+    char path[] = "/tmp/fixed_files_XXXXXX";
+    ::close(mkstemp(path) | coro::PanicOnErr("mkstemp", true));
+    int slot = co_await service.open_direct(AT_FDCWD, path, O_RDWR);
+    check(slot >= 0, "open_direct");
+    coro::FixedFd file{unsigned(slot)};
+    co_await service.write(file, "fixed", 5, 0) | coro::PanicOnErr("write", false);
+    int r = co_await service.read(file, buffer.data(), buffer.size(), 0);
+    check(r == 5 && std::string_view(buffer.data(), 5) == "fixed", "read/write through a FixedFd");
+    check(co_await service.close(file) == 0, "close(FixedFd)");
+    ::unlink(path);
+
+    // a listening socket in the table, accepting into the table
+    int ls = co_await service.socket_direct(AF_INET, SOCK_STREAM, 0);
+    check(ls >= 0, "socket_direct");
+    coro::FixedFd listener{unsigned(ls)};
+    // bind/listen have no ring op before 6.11, use a plain socket for them
+    int plain = co_await service.socket(AF_INET, SOCK_STREAM, 0) | coro::PanicOnErr("socket", false);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    bind(plain, reinterpret_cast<sockaddr*>(&addr), len) | coro::PanicOnErr("bind", true);
+    listen(plain, 8) | coro::PanicOnErr("listen", true);
+    getsockname(plain, reinterpret_cast<sockaddr*>(&addr), &len) | coro::PanicOnErr("getsockname", true);
+    co_await service.close(listener);
+
+    int client = socket(AF_INET, SOCK_STREAM, 0) | coro::PanicOnErr("socket", true);
+    co_await service.connect(client, reinterpret_cast<sockaddr*>(&addr), len) | coro::PanicOnErr("connect", false);
+    int accepted = co_await service.accept_direct(plain, nullptr, nullptr);
+    check(accepted >= 0, "accept_direct");
+    coro::FixedFd conn{unsigned(accepted)};
+
+    co_await service.send(conn, "ping", 4, 0) | coro::PanicOnErr("send", false);
+    r = co_await service.recv(client, buffer.data(), buffer.size(), 0);
+    check(r == 4 && std::string_view(buffer.data(), 4) == "ping", "send through a FixedFd");
+    co_await service.send(client, "pong", 4, 0) | coro::PanicOnErr("send", false);
+    r = co_await service.recv(conn, buffer.data(), buffer.size(), 0);
+    check(r == 4 && std::string_view(buffer.data(), 4) == "pong", "recv through a FixedFd");
+
+    co_await service.close(conn);
+    co_await service.close(client);
+    co_await service.close(plain);
+}
+
+int main() {
+    coro::IOService service;
+    service.register_file_table(16);
+    service.run(run(service));
+    std::cout << "fixed_files: all good" << std::endl;
+}
@@ -1,10 +1,16 @@
 //
 // Created by benny on 2022/3/10.
 //
+#include "io_utils.h"
+
+#include <array>
+#include <cstring>
 #include <iostream>
 #include <chrono>
 #include <ctime>
 #include <iomanip>
+#include <stdexcept>
+#include <string>
 #include <thread>
 
 inline char separator() {
@@ -43,4 +49,23 @@ void PrintTime() {
 void PrintThread() {
   using namespace std;
   cout << " [Thread-" << this_thread::get_id() << "] ";
-}
\ No newline at end of file
+}
+
+coro::Task<int> idle_read(coro::IOService &service, int fd) {
+  std::array<char, 64> buffer;
+  co_return co_await service.read(fd, buffer.data(), buffer.size(), 0);
+}
+
+void check(bool ok, const char *what) {
+  std::cout << what << ": " << (ok ? "ok" : "FAILED") << std::endl;
+  if (!ok) {
+    throw std::runtime_error(what);
+  }
+}
+
+void check(int got, int expected, const char *what) {
+  std::cout << what << ": " << (got < 0 ? strerror(-got) : std::to_string(got)) << std::endl;
+  if (got != expected) {
+    throw std::runtime_error(std::string(what) + ": unexpected result");
+  }
+}
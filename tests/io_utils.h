@@ -7,6 +7,8 @@
 
 #include <iostream>
 
+#include <liburing/io_service.hpp>
+
 const char *file_name(const char *path);
 
 void PrintTime();
@@ -27,6 +29,15 @@ void Println(U... u) {
   std::cout.flush();
 }
 
+// a read nobody ever writes to, like a client that went quiet
+coro::Task<int> idle_read(coro::IOService &service, int fd);
+
+// print whether `what` holds and throw unless it does
+void check(bool ok, const char *what);
+
+// print `got`, an errno when negative, and throw unless it is `expected`
+void check(int got, int expected, const char *what);
+
 #define debug(...) \
 PrintTime();       \
 PrintThread();     \
@@ -0,0 +1,80 @@
+#include <liburing/utils.hpp>
+#include <liburing/io_service.hpp>
+#include <liburing/latency.hpp>
+#include <cstdio>
+#include <iostream>
+
+#include "io_utils.h"
+
+// built with LIBURING_LATENCY_HISTOGRAM
+
+void histogram_math() {
+    using H = coro::LatencyHistogram;
+    bool exact = true;
+    for (uint64_t v = 0; v < (uint64_t(1) << H::MAX_EXP); v = v + v / 7 + 1) {
+        unsigned b = H::bucket_of(v);
+        exact &= H::bucket_value(b) >= v && H::bucket_value(b) - v <= v / H::SUB_BUCKETS;
+        exact &= b == 0 || H::bucket_value(b - 1) < v;
+    }
+    check(exact, "buckets within 1/32 of their values");
+
+    H a, b;
+    for (uint64_t i = 1; i <= 1000; ++i) {
+        (i % 2 ? a : b).record(i * 1000);
+    }
+    a += b;
+    check(a.count() == 1000 && a.max() == 1'000'000, "merge");
+    auto p50 = a.quantile(0.5), p99 = a.quantile(0.99);
+    check(p50 >= 500'000 && p50 <= 500'000 * 33 / 32, "p50");
+    check(p99 >= 990'000 && p99 <= 1'000'000, "p99");
+}
+
+void more_cqes() {
+    coro::OpLatency latency;
+    io_uring_sqe accept{}, send{};
+    accept.opcode = IORING_OP_ACCEPT;
+    accept.user_data = 1;
+    send.opcode = IORING_OP_SEND_ZC;
+    send.user_data = 2;
+    latency.submitted(&accept, 1000);
+    latency.submitted(&send, 1000);
+
+    // a multishot accept waits 1us, then 2us for its next connection
+    latency.completed(1, IORING_CQE_F_MORE, 2000);
+    latency.completed(1, IORING_CQE_F_MORE, 4000);
+    latency.completed(2, IORING_CQE_F_MORE, 1500);
+    latency.completed(2, IORING_CQE_F_NOTIF, 9000);
+
+    coro::LatencySnapshot out;
+    latency.snapshot(out);
+    check(out.op(IORING_OP_ACCEPT).count() == 2 && out.op(IORING_OP_ACCEPT).max() == 2000, "multishot events");
+    check(out.op(IORING_OP_SEND_ZC).count() == 1 && out.op(IORING_OP_SEND_ZC).max() == 500, "zero-copy send without its notification");
+}
+
+auto run(coro::IOService& service) -> coro::Task<> {
+    for (int i = 0; i < 100; ++i) {
+        co_await service.yield();
+    }
+    __kernel_timespec ts{.tv_sec = 0, .tv_nsec = 2'000'000};
+    for (int i = 0; i < 10; ++i) {
+        co_await service.timeout(&ts);
+    }
+}
+
+int main() {
+    histogram_math();
+    more_cqes();
+
+    coro::IOService first, second;
+    first.run(run(first));
+    second.run(run(second));
+
+    coro::LatencySnapshot all;
+    first.latency_snapshot(all);
+    second.latency_snapshot(all);
+    all.print();
+    check(all.op(IORING_OP_NOP).count() == 200, "nops of both rings");
+    check(all.op(IORING_OP_TIMEOUT).count() == 20, "timeouts of both rings");
+    check(all.op(IORING_OP_TIMEOUT).quantile(0.5) >= 2'000'000, "timeouts take their 2ms");
+    std::cout << "latency: all good" << std::endl;
+}
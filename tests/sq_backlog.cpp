@@ -0,0 +1,103 @@
+#include <liburing/utils.hpp>
+#include <liburing/io_service.hpp>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "io_utils.h"
+
+// A ring of 16 entries driving 100 times as many ops at once: the SQ fills up on every round and
+// all timeouts fire together, flooding a CQ of 32 entries. Nothing may panic or get lost.
+// Then ops parked in the backlog by reserve_sqes() are cancelled before the kernel sees them.
+
+constexpr unsigned ENTRIES = 16;
+constexpr unsigned CONCURRENCY = 100 * ENTRIES;
+constexpr unsigned ROUNDS = 100;
+
+auto yielder(coro::IOService& service, unsigned& done) -> coro::Task<> {
+    for (unsigned i = 0; i < ROUNDS; ++i) {
+        co_await service.yield() | coro::PanicOnErr("yield", false);
+    }
+    ++done;
+}
+
+auto sleeper(coro::IOService& service, __kernel_timespec* ts, unsigned& expired) -> coro::Task<> {
+    int r = co_await service.timeout(ts);
+    expired += r == -ETIME;
+}
+
+auto accept_next(coro::AcceptStream& stream) -> coro::Task<int> {
+    co_return co_await stream.next();
+}
+
+auto run(coro::IOService& service) -> coro::Task<> {
+    unsigned done = 0;
+    std::vector<coro::Task<>> tasks;
+    tasks.reserve(CONCURRENCY);
+
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned i = 0; i < CONCURRENCY; ++i) {
+        tasks.push_back(yielder(service, done));
+    }
+    for (auto& task : tasks) {
+        co_await task;
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("%u concurrent nops x %u rounds: %.0f ops/s\n", CONCURRENCY, ROUNDS, CONCURRENCY * ROUNDS / elapsed);
+    check(done == CONCURRENCY, "every nop completed");
+
+    // every completion at once, far more than the CQ holds
+    unsigned expired = 0;
+    __kernel_timespec ts{.tv_sec = 0, .tv_nsec = 20'000'000};
+    tasks.clear();
+    for (unsigned i = 0; i < CONCURRENCY; ++i) {
+        tasks.push_back(sleeper(service, &ts, expired));
+    }
+    for (auto& task : tasks) {
+        co_await task;
+    }
+    check(expired == CONCURRENCY, "every timeout completed");
+    check(service.backlog() == 0, "backlog drained");
+
+    // reserving more than the SQ holds spills every following sqe into the backlog
+    int fds[2];
+    pipe(fds) | coro::PanicOnErr("pipe", true);
+    service.reserve_sqes(ENTRIES + 1);
+    auto reader = idle_read(service, fds[0]);
+    check(service.backlog() == 1, "reserve_sqes spills into the backlog");
+    reader.cancel();
+    check(co_await reader, -ECANCELED, "cancel a read still in the backlog");
+    check(service.backlog() == 0, "backlog drained after the cancel");
+
+    // a multishot cancelled in the backlog must not be submitted afterwards
+    int listener = socket(AF_INET, SOCK_STREAM, 0) | coro::PanicOnErr("socket", true);
+    sockaddr_in addr{.sin_family = AF_INET, .sin_port = 0, .sin_addr = {htonl(INADDR_LOOPBACK)}};
+    bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) | coro::PanicOnErr("bind", true);
+    listen(listener, 8) | coro::PanicOnErr("listen", true);
+    service.reserve_sqes(ENTRIES + 1);
+    {
+        auto stream = service.multishot_accept(listener);
+        check(service.backlog() == 1, "multishot accept in the backlog");
+        auto acceptor = accept_next(stream);
+        acceptor.cancel();
+        check(co_await acceptor, -ECANCELED, "cancel a multishot accept still in the backlog");
+    }
+    co_await service.yield();
+    check(service.backlog() == 0, "backlog drained after the multishot cancel");
+
+    close(listener);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+int main() {
+    coro::IOService service(ENTRIES);
+    service.run(run(service));
+    service.stats().print(stdout);
+    std::cout << "sq_backlog: all good" << std::endl;
+}
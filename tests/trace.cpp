@@ -0,0 +1,60 @@
+#include <liburing/utils.hpp>
+#include <liburing/io_service.hpp>
+#include <liburing/trace.hpp>
+#include <liburing/when_all_any.hpp>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "io_utils.h"
+
+// built with LIBURING_TRACE
+
+using namespace std::chrono_literals;
+
+auto leaf(coro::IOService& service, int fd) -> coro::Task<int> {
+    char c;
+    co_return co_await service.read(fd, &c, 1, 0);
+}
+
+auto request(coro::IOService& service, int fd) -> coro::Task<> {
+    co_await coro::when_all(leaf(service, fd), leaf(service, fd));
+    co_await service.sleep_for(1ms);
+}
+
+int main() {
+    coro::IOService service;
+    int fd = open("/dev/zero", O_RDONLY) | coro::PanicOnErr("open", true);
+    service.run(request(service, fd));
+    close(fd);
+
+    char path[] = "/tmp/trace_XXXXXX";
+    ::close(mkstemp(path) | coro::PanicOnErr("mkstemp", true));
+    check(coro::trace::write_chrome_json(path), "write_chrome_json");
+
+    FILE* in = fopen(path, "r");
+    std::string json;
+    for (int c; (c = fgetc(in)) != EOF;) {
+        json += char(c);
+    }
+    fclose(in);
+    unlink(path);
+
+    auto count = [&](const std::string& needle) {
+        size_t n = 0;
+        for (size_t at = json.find(needle); at != std::string::npos; at = json.find(needle, at + 1)) {
+            ++n;
+        }
+        return n;
+    };
+    check(count("\"ph\":\"b\"") == count("\"ph\":\"e\""), "every span ends");
+    check(count("\"name\":\"task\",\"cat\":\"task\",\"ph\":\"b\"") == 3, "three tasks");
+    check(count("\"name\":\"read\"") == 4, "reads begin and end");
+    check(json.find("\"name\":\"when_all\",\"cat\":\"task\",\"ph\":\"b\"") != std::string::npos, "when_all fan-out");
+    check(json.find("\"name\":\"sleep\"") != std::string::npos, "sleep");
+    std::cout << "trace: all good" << std::endl;
+}
@@ -0,0 +1,90 @@
+// when_all / when_any must not allocate beyond the children's own frames, counted by replacing
+// the global operator new. Built with LIBURING_NO_FRAME_POOL: every coroutine frame, including
+// any a combinator might start, comes from operator new.
+#include <liburing/io_service.hpp>
+#include <liburing/when_all_any.hpp>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <stdexcept>
+#include <vector>
+
+#include "io_utils.h"
+
+static uint64_t allocations = 0;
+
+void* operator new(size_t size) {
+    ++allocations;
+    if (void* p = std::malloc(size)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
+auto hops(coro::IOService& service, int n) -> coro::Task<int> {
+    for (int i = 0; i < n; ++i) {
+        co_await service.yield();
+    }
+    co_return n;
+}
+
+auto void_hops(coro::IOService& service, int n) -> coro::Task<> {
+    co_await hops(service, n);
+}
+
+auto run(coro::IOService& service) -> coro::Task<> {
+    {
+        auto a = hops(service, 3);
+        auto b = void_hops(service, 1);
+        auto c = hops(service, 2);
+        uint64_t before = allocations;
+        auto [x, y, z] = co_await coro::when_all(std::move(a), std::move(b), std::move(c));
+        check(int(allocations - before), 0, "when_all allocations");
+        if (x != 3 || z != 2) throw std::runtime_error("when_all: wrong results");
+    }
+
+    {
+        auto a = hops(service, 3);
+        auto b = hops(service, 1);
+        uint64_t before = allocations;
+        auto [index, value] = co_await coro::when_any(std::move(a), std::move(b));
+        check(int(allocations - before), 0, "when_any allocations");
+        if (index != 1) throw std::runtime_error("when_any: wrong winner");
+    }
+
+    {
+        std::vector<coro::Task<>> tasks;
+        tasks.reserve(8);
+        for (int i = 0; i < 8; ++i) {
+            tasks.push_back(void_hops(service, i));
+        }
+        uint64_t before = allocations;
+        co_await coro::when_all(std::move(tasks));
+        check(int(allocations - before), 0, "when_all over a vector allocations");
+    }
+
+    {
+        std::vector<coro::Task<int>> tasks;
+        tasks.reserve(8);
+        for (int i = 0; i < 8; ++i) {
+            tasks.push_back(hops(service, i));
+        }
+        uint64_t before = allocations;
+        auto results = co_await coro::when_all(std::move(tasks));
+        // the results vector itself
+        check(int(allocations - before), 1, "when_all over a vector with results allocations");
+        if (results.size() != 8 || results[7] != 7) throw std::runtime_error("when_all: wrong results");
+    }
+}
+
+int main() {
+    coro::IOService service;
+    service.run(run(service));
+    std::cout << "when_all_alloc: all good" << std::endl;
+}